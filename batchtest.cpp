@@ -0,0 +1,79 @@
+#include "copynotice.hpp"
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace
+{
+	int failures = 0;
+
+	void expect(bool const Condition, char const* const What)
+	{
+		if (!Condition)
+		{
+			std::printf("FAILED: %s\n", What);
+			++failures;
+		}
+	}
+
+	// Returns the message of the std::invalid_argument thrown by Function, or an empty string if it throws nothing.
+	template <class Fn>
+	std::string invalid_argument_of(Fn&& Function)
+	{
+		try
+		{
+			Function();
+		}
+		catch (std::invalid_argument const& e)
+		{
+			return e.what();
+		}
+		return {};
+	}
+}
+
+// Checks that the errors of a batch are thrown with the text the command line would print, however the console
+// buffers them.
+int wmain()
+{
+	try
+	{
+		copynotice::batch_config config;
+		config.notice = L"Copyright (c) batchtest.";
+		config.extensions.push_back({ L"a.b", {} });
+		auto const extensionError = invalid_argument_of([&] { copynotice::batch batch(config); });
+		expect(extensionError.find("Extension \"a.b\" contains an illegal character") != std::string::npos, "a bad extension is reported");
+
+		config.extensions = { { L"cpp", {} } };
+		config.inPlace = true;
+		copynotice::batch batch(config);
+		copynotice::batch_root const roots[] = { { L"src\\", {} } };
+		std::wstring messages;
+		copynotice::batch_callbacks callbacks;
+		callbacks.message = [&](std::wstring_view const Line)
+		{
+			messages += Line;
+			messages += L'\n';
+		};
+		// Twice, so that the second error is written within the flush interval of the first.
+		for (int i = 0; i < 2; ++i)
+		{
+			messages.clear();
+			auto const rootError = invalid_argument_of([&] { batch.run(roots, callbacks); });
+			expect(rootError.find("trailing slash") != std::string::npos, "a bad root is reported");
+			expect(messages.find(L"trailing slash") != std::wstring::npos, "a bad root is passed to the message callback");
+		}
+	}
+	catch (std::exception const& e)
+	{
+		std::printf("FAILED: %s\n", e.what());
+		return 1;
+	}
+	if (failures == 0)
+	{
+		std::printf("All checks passed.\n");
+	}
+	return failures == 0 ? 0 : 1;
+}
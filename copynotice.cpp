@@ -0,0 +1,5879 @@
+#include "copynotice.hpp"
+#include "wdul/console.hpp"
+#include "wdul/fs.hpp"
+#include "wdul/strconv.hpp"
+#include <algorithm>
+#include <vector>
+#include <array>
+#include <span>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <functional>
+#include <unordered_set>
+#include <unordered_map>
+#include <optional>
+#include <utility>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdio>
+
+namespace program
+{
+	// Standard I/O, or the output of a batch run when detached from it.
+	class console
+	{
+	public:
+		// No copy/move.
+		console(console const&) = delete;
+		console(console&&) = delete;
+		console& operator=(console const&) = delete;
+		console& operator=(console&&) = delete;
+
+		// Tag for the constructor of a console which is not attached to standard I/O.
+		struct detached_t
+		{
+			explicit detached_t() = default;
+		};
+		static constexpr detached_t detached{};
+
+		// The longest time buffered output waits before it is written.
+		static constexpr std::chrono::milliseconds flush_interval{ 100 };
+
+		// Initialises standard input/output handles. Sets the console mode.
+		console();
+
+		// Creates a console which is not attached to standard I/O. Output goes to the sink set by redirect, if any, and
+		// nothing can be read.
+		explicit console(detached_t) noexcept
+		{
+		}
+
+		// Restores the console mode.
+		~console();
+
+		// Writes the spcified string to standard output. Output is buffered, and written to the console once enough of
+		// it has accumulated, once flush_interval has passed since the last console write, or when flush is called. While
+		// a run executes, progress_line calls flush every flush_interval, so buffered output never waits for a next write.
+		console& write(std::wstring_view const Sv)
+		{
+			std::scoped_lock const lock(mMutex);
+			if (!mMuted)
+			{
+				begin_output();
+				mPending += Sv;
+				end_output(Sv);
+			}
+			return *this;
+		}
+
+		// Writes the specified strings to standard output without output from other threads in between.
+		console& write(std::initializer_list<std::wstring_view> const Svs)
+		{
+			std::scoped_lock const lock(mMutex);
+			if (mMuted || Svs.size() == 0) return *this;
+			begin_output();
+			for (auto const sv : Svs)
+			{
+				mPending += sv;
+			}
+			end_output(*(Svs.end() - 1));
+			return *this;
+		}
+
+		// Writes buffered output to the console.
+		void flush()
+		{
+			std::scoped_lock const lock(mMutex);
+			flush_pending();
+		}
+
+		// Replaces the status line, which stays below the rest of the output until it is replaced with an empty line.
+		// The status line is written with the next flush.
+		void status(std::wstring_view const Line)
+		{
+			std::scoped_lock const lock(mMutex);
+			if (mMuted || !mTerminal) return;
+			if (mStatusShown)
+			{
+				mPending += L"\r\x1b[2K";
+				mStatusShown = false;
+			}
+			mStatus = Line;
+			if (!mStatus.empty() && (mPending.empty() || mPending.back() == L'\n'))
+			{
+				mPending += mStatus;
+				mStatusShown = true;
+			}
+		}
+
+		// While muted, writes are discarded. Used to keep console I/O out of benchmark timings.
+		void mute(bool const Muted)
+		{
+			std::scoped_lock const lock(mMutex);
+			mMuted = Muted;
+		}
+
+		// Sets the function which receives each line of the output of a detached console. Lines are passed without their
+		// line break and virtual terminal sequences, while the console is locked. The complete lines written so far go to
+		// the previous sink first, and an unfinished line is discarded, so that no sink receives output written before it
+		// was set.
+		void redirect(std::function<void(std::wstring_view)> Sink)
+		{
+			std::scoped_lock const lock(mMutex);
+			flush_pending();
+			if (!mTerminal) mPending.clear();
+			mSink = std::move(Sink);
+		}
+
+		// Locks the console. Other threads are blocked from writing to or reading from the console until the
+		// returned lock is released. The calling thread may continue to use the console.
+		[[nodiscard]] std::unique_lock<std::recursive_mutex> lock()
+		{
+			return std::unique_lock(mMutex);
+		}
+
+		// Reads from standard input to the specified string.
+		// The previous contents of the specified string are not cleared.
+		// Does not affect the last-read string.
+		void read(std::wstring& Str);
+
+		// Sets the last-read string to the string read from standard input.
+		std::wstring const& read()
+		{
+			mLastRead.clear();
+			read(mLastRead);
+			return mLastRead;
+		}
+
+		auto const& output_handle() const noexcept { return mTerminal->output; }
+		auto const& input_handle() const noexcept { return mTerminal->input; }
+
+		// Returns the last-read string.
+		auto const& last_read() const noexcept { return mLastRead; }
+
+	private:
+		struct terminal
+		{
+			terminal() :
+				output(wdul::get_std_handle(wdul::std_handle_id::output)),
+				input(wdul::get_std_handle(wdul::std_handle_id::input)),
+				prevOutputMode(output.get_mode()),
+				prevInputMode(input.get_mode())
+			{
+			}
+
+			wdul::console_output_handle output;
+			wdul::console_input_handle input;
+			wdul::console_output_mode prevOutputMode;
+			wdul::console_input_mode prevInputMode;
+		};
+
+		std::optional<terminal> mTerminal; // empty if the console is detached.
+		std::function<void(std::wstring_view)> mSink; // receives the output of a detached console.
+		std::wstring mLine; // the line passed to mSink.
+		static constexpr std::size_t mWchBufferSize = 128;
+		wchar_t mWchBuffer[mWchBufferSize];
+		std::wstring mLastRead;
+		std::recursive_mutex mMutex;
+		bool mMuted = false;
+
+		static constexpr std::size_t flush_threshold = 16 * 1024; // in characters.
+
+		// Erases the status line before other output is added after it.
+		void begin_output()
+		{
+			if (mStatusShown)
+			{
+				mPending += L"\r\x1b[2K";
+				mStatusShown = false;
+			}
+		}
+
+		// Puts the status line back once the output ends a line, and flushes if it is time to.
+		void end_output(std::wstring_view const Last)
+		{
+			if (!mStatus.empty() && Last.ends_with(L'\n'))
+			{
+				mPending += mStatus;
+				mStatusShown = true;
+			}
+			if (mPending.size() >= flush_threshold || std::chrono::steady_clock::now() - mLastFlush >= flush_interval)
+			{
+				flush_pending();
+			}
+		}
+
+		void flush_pending()
+		{
+			if (!mPending.empty() && mTerminal)
+			{
+				mTerminal->output.write(mPending);
+				mPending.clear();
+			}
+			else if (!mPending.empty())
+			{
+				deliver_lines();
+			}
+			mLastFlush = std::chrono::steady_clock::now();
+		}
+
+		// Passes the complete lines of the output of a detached console to mSink, and keeps the rest for the next flush.
+		void deliver_lines()
+		{
+			std::size_t lineStart = 0;
+			for (std::size_t lineEnd; (lineEnd = mPending.find(L'\n', lineStart)) != mPending.npos; lineStart = lineEnd + 1)
+			{
+				if (!mSink) continue;
+				// A control sequence is ESC, '[', any parameters, and a final character from '@' to '~'.
+				mLine.clear();
+				for (auto i = lineStart; i < lineEnd; ++i)
+				{
+					if (mPending[i] != L'\x1b')
+					{
+						mLine += mPending[i];
+						continue;
+					}
+					if (i + 1 < lineEnd && mPending[i + 1] == L'[')
+					{
+						for (i += 2; i < lineEnd && !(mPending[i] >= L'@' && mPending[i] <= L'~'); ++i) {}
+					}
+				}
+				mSink(mLine);
+			}
+			mPending.erase(0, lineStart);
+		}
+
+		std::wstring mPending; // output not yet written to the console.
+		std::wstring mStatus;
+		bool mStatusShown = false; // whether mStatus is the last line of the output.
+		std::chrono::steady_clock::time_point mLastFlush;
+	};
+
+	console::console()
+	{
+		wdul::leave_uninitialized(mWchBuffer);
+
+		mTerminal.emplace();
+
+		// Allows virtual terminal sequences. See https://learn.microsoft.com/en-us/windows/console/console-virtual-terminal-sequences.
+		mTerminal->output.set_mode(mTerminal->prevOutputMode | wdul::console_output_mode::enable_virtual_terminal_processing);
+	}
+
+	console::~console()
+	{
+		try
+		{
+			status({});
+			flush_pending();
+			if (mTerminal)
+			{
+				mTerminal->output.write(L"\x1b[0m");
+				mTerminal->output.set_mode(mTerminal->prevOutputMode);
+				mTerminal->input.set_mode(mTerminal->prevInputMode);
+			}
+		}
+		catch (std::exception const& e)
+		{
+			MessageBoxA(nullptr, e.what(), "Failed to restore console IO mode", MB_ICONERROR);
+		}
+	}
+
+	void console::read(std::wstring& Str)
+	{
+		std::scoped_lock const lock(mMutex);
+		if (!mTerminal)
+		{
+			throw std::logic_error("A detached console cannot be read from");
+		}
+		flush_pending();
+		mTerminal->output.write(L"\x1b[0m> ");
+		std::uint32_t numRead;
+		do
+		{
+			numRead = mTerminal->input.read(mWchBuffer);
+			Str.append(mWchBuffer, numRead);
+		} while (numRead == std::size(mWchBuffer));
+		if (Str.ends_with(L"\r\n"))
+		{
+			Str.resize(numRead - 2);
+		}
+	}
+
+	// Gets a boolean input from the user. The last-read string (that is, the string returned by console::last_read) is modified.
+	// Returns true if the user inputs yes.
+	// Returns false if the user inputs no.
+	bool ask_yesno(console& Console)
+	{
+		while (true)
+		{
+			Console.read();
+			if (Console.last_read() == L"y" || Console.last_read() == L"yes")
+			{
+				return true;
+			}
+			else if (Console.last_read() == L"n" || Console.last_read() == L"no")
+			{
+				return false;
+			}
+			Console.write(L"Invalid input. Enter yes or no.\n");
+		}
+	}
+
+	void echo_command_line(console& Cons, int const ArgCount, wchar_t** const Args)
+	{
+		for (int i = 0; i < ArgCount; ++i)
+		{
+			Cons.write(L"Argument ").write(std::to_wstring(i)).write(L": \"").write(Args[i]).write(L"\"\n");
+		}
+	}
+
+	// Shows the number of processed files and the rates of progress on the console's status line, updated a few times
+	// a second by a thread of its own while a run is in progress. Without the status line, the thread still flushes the
+	// console's buffered output every console::flush_interval.
+	class progress_line
+	{
+	public:
+		// No copy/move.
+		progress_line(progress_line const&) = delete;
+		progress_line(progress_line&&) = delete;
+		progress_line& operator=(progress_line const&) = delete;
+		progress_line& operator=(progress_line&&) = delete;
+
+		progress_line() = default;
+
+		~progress_line()
+		{
+			stop();
+		}
+
+		// Counts a processed target file. Does nothing unless the line is shown. May be called from any thread.
+		void add_file(std::uint64_t const Size) noexcept
+		{
+			if (mShown)
+			{
+				mFiles.fetch_add(1, std::memory_order_relaxed);
+				mBytes.fetch_add(Size, std::memory_order_relaxed);
+			}
+		}
+
+		// Resets the counters and starts flushing Cons, and with ShowLine updating the status line.
+		void start(console& Cons, bool const ShowLine)
+		{
+			// A run which threw may have left the thread running.
+			stop();
+			mFiles = 0;
+			mBytes = 0;
+			mStopping = false;
+			mShown = ShowLine;
+			mThread = std::thread([this, &Cons] { run(Cons); });
+		}
+
+		// Stops updating the status line and removes it, and flushes Cons.
+		void stop()
+		{
+			if (!mThread.joinable())
+			{
+				return;
+			}
+			{
+				std::scoped_lock const lock(mMutex);
+				mStopping = true;
+			}
+			mWake.notify_one();
+			mThread.join();
+			mShown = false;
+		}
+
+	private:
+		static constexpr std::chrono::milliseconds interval{ 250 };
+
+		void run(console& Cons)
+		{
+			auto const start = std::chrono::steady_clock::now();
+			wchar_t line[128];
+			std::unique_lock lock(mMutex);
+			while (!mWake.wait_for(lock, mShown ? interval : console::flush_interval, [this] { return mStopping; }))
+			{
+				if (!mShown)
+				{
+					Cons.flush();
+					continue;
+				}
+				auto const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				auto const files = mFiles.load(std::memory_order_relaxed);
+				auto const bytes = mBytes.load(std::memory_order_relaxed);
+				std::swprintf(line, std::size(line), L"\x1b[90m%llu file(s), %.0f files/s, %.1f MiB/s\x1b[0m", static_cast<unsigned long long>(files),
+					static_cast<double>(files) / seconds, static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds);
+				Cons.status(line);
+				Cons.flush();
+			}
+			if (mShown) Cons.status({});
+			Cons.flush();
+		}
+
+		std::atomic<std::uint64_t> mFiles = 0;
+		std::atomic<std::uint64_t> mBytes = 0;
+		std::atomic<bool> mShown = false;
+		bool mStopping = false;
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		std::thread mThread;
+	};
+
+	// Converts a string of decimal digits to an integer.
+	// Returns false if the string is empty, contains a non-digit character, or the value exceeds Max.
+	[[nodiscard]] constexpr bool parse_uint(std::wstring_view const String, std::uint32_t const Max, std::uint32_t& Value)
+	{
+		if (String.empty())
+		{
+			return false;
+		}
+		std::uint64_t result = 0;
+		for (auto const ch : String)
+		{
+			if (ch < L'0' || ch > L'9')
+			{
+				return false;
+			}
+			result = result * 10 + static_cast<std::uint64_t>(ch - L'0');
+			if (result > Max)
+			{
+				return false;
+			}
+		}
+		Value = static_cast<std::uint32_t>(result);
+		return true;
+	}
+
+	// How the subargument of a command-line argument is taken, before instance::init handles the argument.
+	enum class subargument_kind : std::uint8_t
+	{
+		none,
+		required, // the next command-line argument, which must not start with a forward slash.
+		verbatim, // the next command-line argument, which may start with a forward slash.
+		optional, // the next command-line argument, unless it starts with a forward slash.
+		custom,   // taken by the handler of the argument.
+	};
+
+	struct argument_option
+	{
+		std::wstring_view name;
+		subargument_kind subargument;
+		bool repeatable; // the argument may be given more than once.
+	};
+
+	// A sorted array of acceptable command-line arguments. The checks common to every argument are made from this
+	// table, so that instance::init only handles what is particular to each one.
+	inline constexpr argument_option argument_options[] =
+	{
+		{ L"async",       subargument_kind::required, false },
+		{ L"bench",       subargument_kind::optional, false },
+		{ L"check",       subargument_kind::none,     false },
+		{ L"dir",         subargument_kind::custom,   true },
+		{ L"ext",         subargument_kind::required, true },
+		{ L"files",       subargument_kind::required, false },
+		{ L"incremental", subargument_kind::none,     false },
+		{ L"inplace",     subargument_kind::none,     false },
+		{ L"jobs",        subargument_kind::required, false },
+		{ L"link",        subargument_kind::none,     false },
+		{ L"log",         subargument_kind::optional, false },
+		{ L"maxmem",      subargument_kind::required, false },
+		{ L"note",        subargument_kind::required, false },
+		{ L"notef",       subargument_kind::required, false },
+		{ L"overwrite",   subargument_kind::required, false },
+		{ L"progress",    subargument_kind::none,     false },
+		{ L"recurse",     subargument_kind::none,     false },
+		{ L"replace",     subargument_kind::none,     false },
+		{ L"resume",      subargument_kind::required, false },
+		{ L"stats",       subargument_kind::optional, false },
+		{ L"syntax",      subargument_kind::verbatim, true },  // comment syntaxes often start with a slash.
+		{ L"syntaxf",     subargument_kind::required, true },
+		{ L"verbose",     subargument_kind::none,     false },
+		{ L"watch",       subargument_kind::none,     false },
+	};
+	static_assert(std::is_sorted(std::begin(argument_options), std::end(argument_options), [](argument_option const& A, argument_option const& B) { return A.name < B.name; }));
+
+	// Hashes an argument name for argument_slots.
+	[[nodiscard]] constexpr std::uint32_t hash_argument_name(std::wstring_view const Name, std::uint32_t const Seed) noexcept
+	{
+		auto hash = Seed;
+		for (auto const ch : Name)
+		{
+			hash = (hash ^ static_cast<std::uint32_t>(ch)) * 0x01000193;
+		}
+		return hash ^ (hash >> 16);
+	}
+
+	// The size of argument_slots: a power of two, with enough room that a perfect hash is quickly found.
+	inline constexpr std::size_t argument_slot_count = 128;
+	static_assert(argument_slot_count >= 4 * std::size(argument_options));
+
+	// Compile-time search for a seed with which every argument name hashes to a slot of its own.
+	consteval std::uint32_t find_argument_seed()
+	{
+		for (std::uint32_t seed = 1;; ++seed)
+		{
+			bool used[argument_slot_count] = {};
+			bool collision = false;
+			for (auto const& option : argument_options)
+			{
+				auto& slot = used[hash_argument_name(option.name, seed) % argument_slot_count];
+				collision = collision || slot;
+				slot = true;
+			}
+			if (!collision)
+			{
+				return seed;
+			}
+		}
+	}
+
+	inline constexpr std::uint32_t argument_seed = find_argument_seed();
+
+	// Maps each hash slot to the index in argument_options of the name which hashes to it, plus one, or to 0.
+	inline constexpr auto argument_slots = []
+	{
+		std::array<std::uint8_t, argument_slot_count> slots{};
+		for (std::size_t i = 0; i < std::size(argument_options); ++i)
+		{
+			slots[hash_argument_name(argument_options[i].name, argument_seed) % argument_slot_count] = static_cast<std::uint8_t>(i + 1);
+		}
+		return slots;
+	}();
+
+	enum class argument_name_id : std::uint8_t { unknown };
+
+	// Returns a unique value for the given argument name: its index in argument_options, plus one. The name is hashed
+	// once and compared with at most one argument name.
+	// Returns argument_name_id::unknown if the argument name was not found in the argument_options array.
+	[[nodiscard]] constexpr argument_name_id find_argument_name_id(std::wstring_view const String) noexcept
+	{
+		auto const slot = argument_slots[hash_argument_name(String, argument_seed) % argument_slot_count];
+		if (slot == 0 || argument_options[slot - 1].name != String)
+		{
+			return argument_name_id::unknown;
+		}
+		return static_cast<argument_name_id>(slot);
+	}
+	static_assert(find_argument_name_id(L"dir") != argument_name_id::unknown && find_argument_name_id(L"dirs") == argument_name_id::unknown);
+
+	// The size of the buffer used to copy file data when a source file cannot be mapped into memory.
+	inline constexpr std::uint32_t copy_buffer_size = 1024 * 1024;
+
+	// The number of threads enumerating directories for the overlapped I/O engine.
+	inline constexpr std::uint32_t async_walkers = 4;
+
+	// The size of each read made by the overlapped I/O engine.
+	inline constexpr std::uint32_t async_block_size = 256 * 1024;
+
+	// The size of the buffer which ReadDirectoryChangesW reports the changes to a watched directory in. It can't be
+	// larger for directories on network shares.
+	inline constexpr std::uint32_t watch_buffer_size = 64 * 1024;
+
+	// How long /watch waits for changes to stop before it stamps the files which changed.
+	inline constexpr DWORD watch_debounce_milliseconds = 50;
+
+	// Target files of at least this size are copied with unbuffered I/O, so that runs over whole trees don't evict the
+	// rest of the system cache for data which is read and written only once.
+	inline constexpr std::uint64_t unbuffered_threshold = 64 * 1024 * 1024;
+
+	// The alignment of unbuffered reads and writes: their buffers, file offsets and sizes. Volumes with larger sectors
+	// are copied with buffered I/O instead.
+	inline constexpr std::size_t unbuffered_alignment = 4096;
+
+	// The size of each unbuffered read and write; a multiple of unbuffered_alignment.
+	inline constexpr std::uint32_t unbuffered_block_size = 4 * 1024 * 1024;
+
+	// Frees buffers allocated with unbuffered_alignment.
+	struct aligned_delete
+	{
+		void operator()(std::uint8_t* const Buffer) const noexcept
+		{
+			::operator delete[](Buffer, std::align_val_t{ unbuffered_alignment });
+		}
+	};
+
+	// Under /maxmem, the queue of target files may take this fraction of the budget, and the buffer pool the rest. The
+	// split keeps queued files from holding the memory the workers need to take them off the queue.
+	inline constexpr std::uint64_t maxmem_queue_share = 8;
+
+	// The largest number of bytes passed to a single write.
+	inline constexpr std::uint32_t max_write_size = 64 * 1024 * 1024;
+
+	// A read-only view of an entire file, created with a file mapping.
+	class mapped_view
+	{
+	public:
+		// No copy/move.
+		mapped_view(mapped_view const&) = delete;
+		mapped_view(mapped_view&&) = delete;
+		mapped_view& operator=(mapped_view const&) = delete;
+		mapped_view& operator=(mapped_view&&) = delete;
+
+		// Maps the specified file into memory. If the file cannot be mapped, the view is left empty; no exception
+		// is thrown, so that the caller can fall back to buffered reads.
+		explicit mapped_view(HANDLE const File) noexcept
+		{
+			HANDLE const mapping = CreateFileMappingW(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+			{
+				// The view keeps a reference to the mapping object, so the mapping handle can be closed straight away.
+				mData = static_cast<std::uint8_t const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				CloseHandle(mapping);
+			}
+		}
+
+		~mapped_view()
+		{
+			if (mData) UnmapViewOfFile(mData);
+		}
+
+		explicit operator bool() const noexcept { return mData != nullptr; }
+
+		auto data() const noexcept { return mData; }
+
+	private:
+		std::uint8_t const* mData = nullptr;
+	};
+
+	// Writes the specified data to a file using as few writes as possible.
+	void write_all(HANDLE const File, std::uint64_t Size, std::uint8_t const* Data)
+	{
+		while (Size != 0)
+		{
+			auto const writeSize = static_cast<std::uint32_t>(std::min<std::uint64_t>(Size, max_write_size));
+			wdul::fwrite(File, writeSize, Data);
+			Data += writeSize;
+			Size -= writeSize;
+		}
+	}
+
+	// Returns true if unbuffered I/O on a file may use unbuffered_alignment for its buffers, offsets and sizes.
+	[[nodiscard]] inline bool allows_unbuffered(HANDLE const File) noexcept
+	{
+		FILE_STORAGE_INFO storage;
+		return GetFileInformationByHandleEx(File, FileStorageInfo, &storage, sizeof(storage)) &&
+			storage.LogicalBytesPerSector != 0 && unbuffered_alignment % storage.LogicalBytesPerSector == 0;
+	}
+
+	// Moves the end of a file, extending or truncating it. Returns false on failure, with the error in GetLastError.
+	inline bool set_file_size(HANDLE const File, std::uint64_t const Size) noexcept
+	{
+		FILE_END_OF_FILE_INFO endOfFile;
+		endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(Size);
+		return SetFileInformationByHandle(File, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile));
+	}
+
+	// Owns a handle to a kernel object, closing it on destruction.
+	class unique_handle
+	{
+	public:
+		unique_handle() noexcept = default;
+
+		// Takes ownership of the handle. Null and INVALID_HANDLE_VALUE are both treated as no handle.
+		explicit unique_handle(HANDLE const Handle) noexcept :
+			mHandle(Handle == INVALID_HANDLE_VALUE ? nullptr : Handle)
+		{
+		}
+
+		unique_handle(unique_handle&& Other) noexcept :
+			mHandle(std::exchange(Other.mHandle, nullptr))
+		{
+		}
+
+		unique_handle& operator=(unique_handle&& Other) noexcept
+		{
+			reset(std::exchange(Other.mHandle, nullptr));
+			return *this;
+		}
+
+		unique_handle(unique_handle const&) = delete;
+		unique_handle& operator=(unique_handle const&) = delete;
+
+		~unique_handle()
+		{
+			if (mHandle) CloseHandle(mHandle);
+		}
+
+		// Closes the owned handle, if any, and takes ownership of the specified handle.
+		void reset(HANDLE const Handle = nullptr) noexcept
+		{
+			if (mHandle) CloseHandle(mHandle);
+			mHandle = Handle == INVALID_HANDLE_VALUE ? nullptr : Handle;
+		}
+
+		explicit operator bool() const noexcept { return mHandle != nullptr; }
+
+		HANDLE get() const noexcept { return mHandle; }
+
+	private:
+		HANDLE mHandle = nullptr;
+	};
+
+	// Returns the 64-bit FNV-1a hash of the specified bytes, continuing from the specified hash.
+	[[nodiscard]] constexpr std::uint64_t fnv1a(std::uint64_t Hash, std::span<std::byte const> const Bytes) noexcept
+	{
+		for (auto const byte : Bytes)
+		{
+			Hash = (Hash ^ std::to_integer<std::uint64_t>(byte)) * 0x100000001B3;
+		}
+		return Hash;
+	}
+
+	// The FNV-1a offset basis, which is the initial value passed to fnv1a.
+	inline constexpr std::uint64_t fnv1a_basis = 0xCBF29CE484222325;
+
+	// The encoding and line-ending style of a target file. Headers are written in the format of the file they are
+	// inserted into, so that stamping never mixes encodings or line endings within one file.
+	enum class text_format : std::uint8_t
+	{
+		utf8_crlf,
+		utf8_lf,
+		utf16le_crlf,
+		utf16le_lf,
+		utf16be_crlf,
+		utf16be_lf,
+		count,
+	};
+
+	// The encodings of text_format, in the same order.
+	enum class text_encoding : std::uint8_t
+	{
+		utf8,
+		utf16le,
+		utf16be,
+		count,
+	};
+
+	[[nodiscard]] constexpr text_encoding encoding_of(text_format const Format) noexcept
+	{
+		return static_cast<text_encoding>(static_cast<std::size_t>(Format) / 2);
+	}
+
+	[[nodiscard]] constexpr bool uses_lf(text_format const Format) noexcept
+	{
+		return static_cast<std::size_t>(Format) % 2 != 0;
+	}
+
+	// The byte order marks recognised at the start of target files, indexed by text_encoding. A UTF-8 file need not
+	// start with one.
+	inline constexpr std::u8string_view byte_order_marks[]
+	{
+		u8"\xEF\xBB\xBF",
+		std::u8string_view(u8"\xFF\xFE", 2),
+		std::u8string_view(u8"\xFE\xFF", 2),
+	};
+
+	// The format of a target file, as detected from its first bytes by sniff_text.
+	struct text_sniff
+	{
+		text_format format;
+		std::size_t bomSize; // the size of the byte order mark, which stays at the start of the output file.
+	};
+
+	// Returns the offset just past the first newline at or after From, or npos if Data holds none. In UTF-16, only
+	// whole code units count, relative to the start of Data.
+	[[nodiscard]] std::size_t find_line_end(std::span<std::uint8_t const> const Data, std::size_t From, text_encoding const Encoding) noexcept
+	{
+		while (From < Data.size())
+		{
+			// memchr is vectorised by the CRT, so long comment lines are skipped quickly.
+			auto const newline = static_cast<std::uint8_t const*>(std::memchr(Data.data() + From, '\n', Data.size() - From));
+			if (!newline)
+			{
+				break;
+			}
+			auto const offset = static_cast<std::size_t>(newline - Data.data());
+			switch (Encoding)
+			{
+			case text_encoding::utf8:
+				return offset + 1;
+			case text_encoding::utf16le:
+				if (offset % 2 == 0 && offset + 1 < Data.size() && Data[offset + 1] == 0) return offset + 2;
+				break;
+			case text_encoding::utf16be:
+				if (offset % 2 != 0 && Data[offset - 1] == 0) return offset + 1;
+				break;
+			}
+			From = offset + 1;
+		}
+		return std::u8string_view::npos;
+	}
+
+	// Detects the encoding of a target file from its byte order mark, and its line-ending style from the first
+	// newline in Head. Files without a newline in Head are taken to use "\r\n".
+	[[nodiscard]] text_sniff sniff_text(std::span<std::uint8_t const> const Head) noexcept
+	{
+		auto encoding = text_encoding::utf8;
+		std::size_t bomSize = 0;
+		for (std::size_t i = 0; i != std::size(byte_order_marks); ++i)
+		{
+			auto const bom = byte_order_marks[i];
+			if (Head.size() >= bom.size() && std::memcmp(Head.data(), bom.data(), bom.size()) == 0)
+			{
+				encoding = static_cast<text_encoding>(i);
+				bomSize = bom.size();
+				break;
+			}
+		}
+		auto const text = Head.subspan(bomSize);
+		auto const unit = encoding == text_encoding::utf8 ? std::size_t{ 1 } : std::size_t{ 2 };
+		bool lf = false;
+		if (auto const lineEnd = find_line_end(text, 0, encoding); lineEnd != std::u8string_view::npos)
+		{
+			auto const newline = lineEnd - unit;
+			if (newline < unit)
+			{
+				lf = true;
+			}
+			else switch (encoding)
+			{
+			case text_encoding::utf8:
+				lf = text[newline - 1] != '\r';
+				break;
+			case text_encoding::utf16le:
+				lf = text[newline - 2] != '\r' || text[newline - 1] != 0;
+				break;
+			case text_encoding::utf16be:
+				lf = text[newline - 2] != 0 || text[newline - 1] != '\r';
+				break;
+			}
+		}
+		return { static_cast<text_format>(static_cast<std::size_t>(encoding) * 2 + lf), bomSize };
+	}
+
+	// Returns UTF-8 text encoded in the specified encoding, as bytes.
+	[[nodiscard]] std::u8string encode_text(std::u8string_view const Text, text_encoding const Encoding)
+	{
+		if (Encoding == text_encoding::utf8)
+		{
+			return std::u8string(Text);
+		}
+		auto const utf16 = wdul::utf8_to_utf16(Text);
+		std::u8string bytes;
+		bytes.reserve(utf16.size() * 2);
+		for (auto const ch : utf16)
+		{
+			auto const low = static_cast<char8_t>(ch & 0xFF);
+			auto const high = static_cast<char8_t>((ch >> 8) & 0xFF);
+			bytes += Encoding == text_encoding::utf16le ? low : high;
+			bytes += Encoding == text_encoding::utf16le ? high : low;
+		}
+		return bytes;
+	}
+
+	// A value substituted into the notice of each target file.
+	enum class notice_field : std::uint8_t
+	{
+		file, // the name of the target file.
+		root, // the name of the /dir root the target file was found under.
+	};
+
+	// The placeholder of each notice_field in notices. "{year}" isn't one of them: it is the same in every file, so init
+	// substitutes it before the notice is rendered.
+	inline constexpr std::u8string_view notice_placeholders[] = { u8"{file}", u8"{root}" };
+
+	// The most UTF-16 code units of a field which are written: the longest name of a file or directory. Each takes up to
+	// three bytes in UTF-8, and two in UTF-16.
+	inline constexpr std::size_t max_field_length = 255;
+	inline constexpr std::size_t max_field_size = 3 * max_field_length;
+
+	// Where a field goes in a header, once the header's placeholders have been removed from it.
+	struct header_field
+	{
+		std::size_t offset; // into the header without its placeholders.
+		notice_field field;
+	};
+
+	// Appends up to max_field_length code units of UTF-16 text to Out in the specified encoding. Out only allocates
+	// while it grows, so a buffer which is reused for every file stops allocating.
+	void append_field(std::u8string& Out, std::wstring_view Text, text_encoding const Encoding)
+	{
+		Text = Text.substr(0, max_field_length);
+		for (std::size_t i = 0; i != Text.size(); ++i)
+		{
+			auto const ch = static_cast<std::uint32_t>(Text[i]);
+			if (Encoding != text_encoding::utf8)
+			{
+				auto const low = static_cast<char8_t>(ch & 0xFF);
+				auto const high = static_cast<char8_t>(ch >> 8);
+				Out += Encoding == text_encoding::utf16le ? low : high;
+				Out += Encoding == text_encoding::utf16le ? high : low;
+				continue;
+			}
+			std::uint32_t codePoint = ch;
+			if (ch >= 0xD800 && ch < 0xE000)
+			{
+				// Unpaired surrogates become U+FFFD, the replacement character.
+				auto const next = i + 1 != Text.size() ? static_cast<std::uint32_t>(Text[i + 1]) : 0;
+				if (ch < 0xDC00 && next >= 0xDC00 && next < 0xE000)
+				{
+					codePoint = 0x10000 + ((ch - 0xD800) << 10) + (next - 0xDC00);
+					++i;
+				}
+				else
+				{
+					codePoint = 0xFFFD;
+				}
+			}
+			if (codePoint < 0x80)
+			{
+				Out += static_cast<char8_t>(codePoint);
+			}
+			else if (codePoint < 0x800)
+			{
+				Out += static_cast<char8_t>(0xC0 | (codePoint >> 6));
+				Out += static_cast<char8_t>(0x80 | (codePoint & 0x3F));
+			}
+			else if (codePoint < 0x10000)
+			{
+				Out += static_cast<char8_t>(0xE0 | (codePoint >> 12));
+				Out += static_cast<char8_t>(0x80 | ((codePoint >> 6) & 0x3F));
+				Out += static_cast<char8_t>(0x80 | (codePoint & 0x3F));
+			}
+			else
+			{
+				Out += static_cast<char8_t>(0xF0 | (codePoint >> 18));
+				Out += static_cast<char8_t>(0x80 | ((codePoint >> 12) & 0x3F));
+				Out += static_cast<char8_t>(0x80 | ((codePoint >> 6) & 0x3F));
+				Out += static_cast<char8_t>(0x80 | (codePoint & 0x3F));
+			}
+		}
+	}
+
+	// How notices are written as comments in the target files of one or more extensions.
+	struct comment_syntax
+	{
+		std::u8string prefix; // with line comments, the start of each comment line, such as "// ". With block comments, the opening token, such as "/*".
+		std::u8string close;  // with block comments, the closing token, such as "*/". Empty for line comments.
+		std::u8string headers[static_cast<std::size_t>(text_format::count)]; // the notice rendered in this syntax in each text_format, written to the start of every output file.
+		std::u8string prefixes[static_cast<std::size_t>(text_encoding::count)]; // prefix in each text_encoding.
+		std::u8string closes[static_cast<std::size_t>(text_encoding::count)];   // close in each text_encoding.
+		std::vector<header_field> fields[static_cast<std::size_t>(text_format::count)]; // where the placeholders were in each header, in order; empty for a notice without placeholders.
+		std::uint64_t noticeHash = 0; // identifies the header and replace mode in stamp manifests.
+
+		[[nodiscard]] bool block() const noexcept { return !close.empty(); }
+
+		[[nodiscard]] std::u8string const& header(text_format const Format) const noexcept { return headers[static_cast<std::size_t>(Format)]; }
+
+		// Returns the most bytes the header of a target file can take in the specified format.
+		[[nodiscard]] std::size_t header_room(text_format const Format) const noexcept
+		{
+			return header(Format).size() + fields[static_cast<std::size_t>(Format)].size() * max_field_size;
+		}
+
+		// Returns the header of a target file in the specified format, with the name of the file and of its /dir root in
+		// place of the notice's placeholders. Without placeholders, this is the header rendered by render; otherwise it
+		// is assembled in Buffer from the pieces render split it into, so the notice is never parsed again.
+		[[nodiscard]] std::u8string_view header(text_format const Format, std::wstring_view const File, std::wstring_view const Root, std::u8string& Buffer) const
+		{
+			auto const& literal = header(Format);
+			auto const& formatFields = fields[static_cast<std::size_t>(Format)];
+			if (formatFields.empty())
+			{
+				return literal;
+			}
+			Buffer.clear();
+			std::size_t from = 0;
+			for (auto const& field : formatFields)
+			{
+				Buffer.append(literal, from, field.offset - from);
+				append_field(Buffer, field.field == notice_field::file ? File : Root, encoding_of(Format));
+				from = field.offset;
+			}
+			Buffer.append(literal, from);
+			return Buffer;
+		}
+
+		// Renders Notice into headers. Lines of the notice may end with either "\r\n" or "\n". Line comments prefix each
+		// line; a block comment opens on a line of its own, followed by the notice and a line which closes it. Each
+		// variant is rendered and converted once here, so no target file needs any conversion. Placeholders are cut out
+		// of the headers and recorded in fields, so that only the fields are converted per file.
+		void render(std::u8string_view const Notice, bool const Replace)
+		{
+			for (std::size_t lf = 0; lf != 2; ++lf)
+			{
+				std::u8string_view const newline = lf ? u8"\n" : u8"\r\n";
+				std::u8string header;
+				if (block())
+				{
+					header += prefix;
+					header += newline;
+				}
+				for (std::size_t lineStart = 0;;)
+				{
+					auto lineEnd = Notice.find(u8'\n', lineStart);
+					auto const last = lineEnd == Notice.npos;
+					if (last) lineEnd = Notice.size();
+					auto const line = Notice.substr(lineStart, lineEnd - lineStart);
+					if (!block()) header += prefix;
+					header += line.ends_with(u8'\r') ? line.substr(0, line.size() - 1) : line;
+					header += newline;
+					if (last) break;
+					lineStart = lineEnd + 1;
+				}
+				if (block())
+				{
+					header += close;
+					header += newline;
+				}
+				if (!lf)
+				{
+					noticeHash = fnv1a(fnv1a_basis, std::as_bytes(std::span(header)));
+					noticeHash = fnv1a(noticeHash, std::as_bytes(std::span(&Replace, 1)));
+				}
+				for (std::size_t encoding = 0; encoding != static_cast<std::size_t>(text_encoding::count); ++encoding)
+				{
+					auto& literal = headers[encoding * 2 + lf];
+					auto& formatFields = fields[encoding * 2 + lf];
+					literal.clear();
+					formatFields.clear();
+					for (std::size_t from = 0;;)
+					{
+						auto next = std::u8string_view::npos;
+						std::size_t field = 0;
+						for (std::size_t i = 0; i != std::size(notice_placeholders); ++i)
+						{
+							auto const found = std::u8string_view(header).find(notice_placeholders[i], from);
+							if (found < next)
+							{
+								next = found;
+								field = i;
+							}
+						}
+						literal += encode_text(std::u8string_view(header).substr(from, next - from), static_cast<text_encoding>(encoding));
+						if (next == std::u8string_view::npos) break;
+						formatFields.push_back({ literal.size(), static_cast<notice_field>(field) });
+						from = next + notice_placeholders[field].size();
+					}
+				}
+			}
+			for (std::size_t encoding = 0; encoding != static_cast<std::size_t>(text_encoding::count); ++encoding)
+			{
+				prefixes[encoding] = encode_text(prefix, static_cast<text_encoding>(encoding));
+				closes[encoding] = encode_text(close, static_cast<text_encoding>(encoding));
+			}
+		}
+	};
+
+	// The result of find_body_offset.
+	struct body_scan
+	{
+		// If complete, the offset of the body. Otherwise, the offset of the first line which could not be classified;
+		// every line before it is a comment line that will be replaced.
+		std::size_t offset;
+		bool complete;
+	};
+
+	// Finds where the body of a source file starts, that is, the offset of the first byte copied after the header.
+	// Data starts after any byte order mark and is encoded as Encoding. Unless Replace is set, the body is the whole
+	// file. Otherwise, the leading comments in Syntax are skipped: lines which start with the comment prefix, or block
+	// comments which start a line, up to the end of the line on which they close. If Data ends inside the leading
+	// comments and AtEnd is false, the scan is incomplete and more of the file is needed to find the body.
+	[[nodiscard]] body_scan find_body_offset(std::span<std::uint8_t const> const Data, comment_syntax const& Syntax, text_encoding const Encoding, bool const Replace, bool const AtEnd) noexcept
+	{
+		if (!Replace)
+		{
+			return { 0, true };
+		}
+		std::u8string_view const CommentPrefix = Syntax.prefixes[static_cast<std::size_t>(Encoding)];
+		std::u8string_view const Close = Syntax.closes[static_cast<std::size_t>(Encoding)];
+		std::size_t lineStart = 0;
+		while (lineStart != Data.size())
+		{
+			auto const remaining = Data.size() - lineStart;
+			auto const compareSize = std::min(remaining, CommentPrefix.size());
+			if (std::memcmp(Data.data() + lineStart, CommentPrefix.data(), compareSize) != 0)
+			{
+				return { lineStart, true };
+			}
+			if (compareSize != CommentPrefix.size())
+			{
+				// The line is shorter than the comment prefix so far.
+				return { lineStart, AtEnd };
+			}
+			auto commentEnd = lineStart + compareSize;
+			if (Syntax.block())
+			{
+				// In UTF-16, a match must start on a code unit.
+				auto close = Data.begin() + commentEnd;
+				while ((close = std::search(close, Data.end(), Close.begin(), Close.end())) != Data.end() &&
+					Encoding != text_encoding::utf8 && (close - Data.begin()) % 2 != 0)
+				{
+					++close;
+				}
+				if (close == Data.end())
+				{
+					// The block comment may close past the end of Data.
+					return { AtEnd ? Data.size() : lineStart, AtEnd };
+				}
+				commentEnd = static_cast<std::size_t>(close - Data.begin()) + Close.size();
+			}
+			auto const lineEnd = find_line_end(Data, commentEnd, Encoding);
+			if (lineEnd == std::u8string_view::npos)
+			{
+				// The last line is a comment, which may continue past the end of Data.
+				return { AtEnd ? Data.size() : lineStart, AtEnd };
+			}
+			lineStart = lineEnd;
+		}
+		return { lineStart, AtEnd };
+	}
+
+	[[nodiscard]] constexpr std::uint64_t to_uint64(FILETIME const Time) noexcept
+	{
+		return (std::uint64_t{ Time.dwHighDateTime } << 32) | Time.dwLowDateTime;
+	}
+
+	// The size and last-write time of a target file, as reported by directory enumeration.
+	struct file_attributes
+	{
+		std::uint64_t size;
+		std::uint64_t lastWriteTime;
+
+		[[nodiscard]] static constexpr file_attributes from(WIN32_FIND_DATAW const& FindData) noexcept
+		{
+			return { (std::uint64_t{ FindData.nFileSizeHigh } << 32) | FindData.nFileSizeLow, to_uint64(FindData.ftLastWriteTime) };
+		}
+	};
+
+	// Hashes and compares paths case-insensitively, the way the file system compares file names, so that a path
+	// spelled with the target file's case finds an output file spelled with different case.
+	struct path_hash
+	{
+		std::size_t operator()(std::wstring_view Path) const noexcept
+		{
+			std::uint64_t hash = fnv1a_basis;
+			wchar_t upper[64];
+			while (!Path.empty())
+			{
+				auto const size = std::min(Path.size(), std::size(upper));
+				std::copy_n(Path.data(), size, upper);
+				CharUpperBuffW(upper, static_cast<DWORD>(size));
+				hash = fnv1a(hash, std::as_bytes(std::span(upper, size)));
+				Path.remove_prefix(size);
+			}
+			return static_cast<std::size_t>(hash);
+		}
+	};
+
+	struct path_equal
+	{
+		bool operator()(std::wstring_view const A, std::wstring_view const B) const noexcept
+		{
+			return CompareStringOrdinal(A.data(), static_cast<int>(A.size()), B.data(), static_cast<int>(B.size()), TRUE) == CSTR_EQUAL;
+		}
+	};
+
+	// Records the state of each file written below a destination root, so that a later run in /incremental mode can
+	// skip files which have not changed. Safe to use from several threads at once.
+	class stamp_manifest
+	{
+	public:
+		struct entry
+		{
+			std::uint64_t srcSize;
+			std::uint64_t srcWriteTime;
+			std::uint64_t dstWriteTime;
+			std::uint64_t noticeHash;
+		};
+
+		// No copy/move.
+		stamp_manifest(stamp_manifest const&) = delete;
+		stamp_manifest(stamp_manifest&&) = delete;
+		stamp_manifest& operator=(stamp_manifest const&) = delete;
+		stamp_manifest& operator=(stamp_manifest&&) = delete;
+
+		// Loads the manifest stored in the specified destination root directory (the current directory if empty).
+		// A missing or malformed manifest is treated as an empty one.
+		explicit stamp_manifest(std::wstring_view const DstRoot);
+
+		// Returns the entry recorded for the path by the previous run, if there is one.
+		[[nodiscard]] std::optional<entry> find(std::wstring const& RelativePath) const
+		{
+			std::scoped_lock const lock(mMutex);
+			auto const it = mPrevious.find(RelativePath);
+			if (it == mPrevious.end())
+			{
+				return std::nullopt;
+			}
+			return it->second;
+		}
+
+		// Records the entry for the path in the manifest written by save.
+		void record(std::wstring&& RelativePath, entry const& Entry)
+		{
+			std::scoped_lock const lock(mMutex);
+			mCurrent.insert_or_assign(std::move(RelativePath), Entry);
+		}
+
+		// Replaces the stored manifest with the entries recorded during this run. Entries for files which were not
+		// seen during this run are dropped.
+		void save() const;
+
+		// The name of the manifest file in each destination root. The file is hidden, so it is never a target file.
+		static constexpr std::wstring_view file_name = L".copynotice-manifest";
+
+	private:
+		static constexpr char magic[8] = { 'C', 'N', 'M', 'A', 'N', 'I', 'F', '1' };
+
+		std::wstring mPath;
+		std::unordered_map<std::wstring, entry, path_hash, path_equal> mPrevious; // keyed case-insensitively, as the file system names files.
+		std::unordered_map<std::wstring, entry, path_hash, path_equal> mCurrent;
+		mutable std::mutex mMutex;
+	};
+
+	stamp_manifest::stamp_manifest(std::wstring_view const DstRoot) :
+		mPath(DstRoot)
+	{
+		if (!mPath.empty()) mPath += L'\\';
+		mPath += file_name;
+		if (!wdul::fexists(mPath.data()))
+		{
+			return;
+		}
+
+		auto file = wdul::fopen(mPath.data(), wdul::file_open_mode::open_existing, FILE_FLAG_SEQUENTIAL_SCAN, wdul::generic_access::read, wdul::file_share_mode::read);
+		auto const size = wdul::fgetsize(file.get());
+		if (size > 0xFFFFFFFF)
+		{
+			return;
+		}
+		std::vector<std::uint8_t> data(static_cast<std::size_t>(size));
+		for (std::size_t offset = 0; offset != data.size();)
+		{
+			auto const readSize = wdul::fread(file.get(), static_cast<std::uint32_t>(data.size() - offset), data.data() + offset);
+			if (readSize == 0)
+			{
+				return;
+			}
+			offset += readSize;
+		}
+
+		// Layout: magic, u64 entry count, then for each entry: entry, u32 path length, path (UTF-16).
+		std::size_t pos = 0;
+		auto const take = [&](void* const Out, std::size_t const Size)
+		{
+			if (data.size() - pos < Size)
+			{
+				return false;
+			}
+			std::memcpy(Out, data.data() + pos, Size);
+			pos += Size;
+			return true;
+		};
+		char fileMagic[sizeof(magic)];
+		std::uint64_t count;
+		if (!take(fileMagic, sizeof(fileMagic)) || std::memcmp(fileMagic, magic, sizeof(magic)) != 0 || !take(&count, sizeof(count)))
+		{
+			return;
+		}
+		decltype(mPrevious) entries;
+		for (std::uint64_t i = 0; i < count; ++i)
+		{
+			entry e;
+			std::uint32_t pathLength;
+			if (!take(&e, sizeof(e)) || !take(&pathLength, sizeof(pathLength)) || (data.size() - pos) / sizeof(wchar_t) < pathLength)
+			{
+				return;
+			}
+			std::wstring path(pathLength, L'\0');
+			take(path.data(), pathLength * sizeof(wchar_t));
+			entries.insert_or_assign(std::move(path), e);
+		}
+		mPrevious = std::move(entries);
+	}
+
+	void stamp_manifest::save() const
+	{
+		std::scoped_lock const lock(mMutex);
+
+		std::vector<std::uint8_t> data;
+		auto const put = [&](void const* const In, std::size_t const Size)
+		{
+			auto const bytes = static_cast<std::uint8_t const*>(In);
+			data.insert(data.end(), bytes, bytes + Size);
+		};
+		std::uint64_t const count = mCurrent.size();
+		put(magic, sizeof(magic));
+		put(&count, sizeof(count));
+		for (auto const& [path, e] : mCurrent)
+		{
+			auto const pathLength = static_cast<std::uint32_t>(path.size());
+			put(&e, sizeof(e));
+			put(&pathLength, sizeof(pathLength));
+			put(path.data(), path.size() * sizeof(wchar_t));
+		}
+
+		// Write to a temporary file first, so that an interrupted save leaves the previous manifest intact.
+		auto const tempPath = mPath + L".tmp";
+		{
+			auto file = wdul::fopen(tempPath.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_HIDDEN, wdul::generic_access::write, wdul::file_share_mode::read);
+			write_all(file.get(), data.size(), data.data());
+			file.close();
+		}
+		wdul::check_bool(MoveFileExW(tempPath.data(), mPath.data(), MOVEFILE_REPLACE_EXISTING));
+	}
+
+	// Stores null-terminated strings in large blocks, so that each string doesn't need an allocation of its own.
+	// Strings stay valid until the arena is cleared or destroyed. Not thread-safe.
+	class string_arena
+	{
+	public:
+		string_arena() = default;
+
+		string_arena(string_arena const&) = delete;
+		string_arena(string_arena&&) = delete;
+		string_arena& operator=(string_arena const&) = delete;
+		string_arena& operator=(string_arena&&) = delete;
+
+		// Stores the concatenation of Pieces.
+		std::wstring_view store(std::initializer_list<std::wstring_view> const Pieces)
+		{
+			std::size_t length = 0;
+			for (auto const piece : Pieces)
+			{
+				length += piece.size();
+			}
+			if (mRemaining < length + 1)
+			{
+				auto const size = std::max(block_size, length + 1);
+				mNext = mBlocks.emplace_back(std::make_unique_for_overwrite<wchar_t[]>(size)).get();
+				mRemaining = size;
+			}
+			auto const string = mNext;
+			for (auto const piece : Pieces)
+			{
+				mNext = std::copy(piece.begin(), piece.end(), mNext);
+			}
+			*mNext++ = L'\0';
+			mRemaining -= length + 1;
+			return { string, length };
+		}
+
+		void clear() noexcept
+		{
+			mBlocks.clear();
+			mNext = nullptr;
+			mRemaining = 0;
+		}
+
+	private:
+		static constexpr std::size_t block_size = 64 * 1024;
+
+		std::vector<std::unique_ptr<wchar_t[]>> mBlocks;
+		wchar_t* mNext = nullptr;
+		std::size_t mRemaining = 0;
+	};
+
+	// Reads a UTF-8 text file line by line through one buffer, which only grows for lines longer than it, so that lists
+	// of any length are read in constant memory. Reads from pipes as well as files.
+	class line_reader
+	{
+	public:
+		// No copy/move.
+		line_reader(line_reader const&) = delete;
+		line_reader(line_reader&&) = delete;
+		line_reader& operator=(line_reader const&) = delete;
+		line_reader& operator=(line_reader&&) = delete;
+
+		explicit line_reader(HANDLE const File) :
+			mFile(File),
+			mBuffer(64 * 1024)
+		{
+		}
+
+		// Sets Line to the next line, without its line ending. Line is valid until the next call.
+		// Returns false once every line has been read.
+		[[nodiscard]] bool next(std::u8string_view& Line)
+		{
+			for (;;)
+			{
+				auto const newline = static_cast<char8_t const*>(std::memchr(mBuffer.data() + mStart, '\n', mEnd - mStart));
+				if (newline || (mAtEnd && mStart != mEnd))
+				{
+					auto const lineEnd = newline ? static_cast<std::size_t>(newline - mBuffer.data()) : mEnd;
+					Line = std::u8string_view(mBuffer.data() + mStart, lineEnd - mStart);
+					if (Line.ends_with(u8'\r')) Line.remove_suffix(1);
+					mStart = newline ? lineEnd + 1 : mEnd;
+					return true;
+				}
+				if (mAtEnd)
+				{
+					return false;
+				}
+
+				// Keep the start of the incomplete line, and read more after it.
+				std::memmove(mBuffer.data(), mBuffer.data() + mStart, mEnd - mStart);
+				mEnd -= mStart;
+				mStart = 0;
+				if (mEnd == mBuffer.size())
+				{
+					mBuffer.resize(mBuffer.size() * 2);
+				}
+				DWORD readSize;
+				if (!ReadFile(mFile, mBuffer.data() + mEnd, static_cast<DWORD>(std::min<std::size_t>(mBuffer.size() - mEnd, 1u << 30)), &readSize, nullptr))
+				{
+					auto const lastError = GetLastError();
+					if (lastError != ERROR_BROKEN_PIPE)
+					{
+						wdul::throw_win32(lastError, "Could not read a list of files");
+					}
+					// The writer of a pipe has closed it.
+					readSize = 0;
+				}
+				mAtEnd = readSize == 0;
+				mEnd += readSize;
+			}
+		}
+
+	private:
+		HANDLE mFile;
+		std::vector<char8_t> mBuffer;
+		std::size_t mStart = 0; // the start of the next line in mBuffer.
+		std::size_t mEnd = 0;   // the end of the data read into mBuffer.
+		bool mAtEnd = false;
+	};
+
+	// Holds a source and destination directory name. Both are null-terminated: they point into the command line, or
+	// into instance::mDirectoryPaths for subdirectories.
+	struct directory_argument
+	{
+		std::wstring_view src;
+		std::wstring_view dst;
+		std::size_t rootLength = 0; // the length of the src path of the /dir argument this directory was found under.
+		stamp_manifest* manifest = nullptr; // the manifest of the destination root, in /incremental mode.
+		std::uint32_t cloneClusterSize = 0; // see block_clone_cluster_size; 0 if output files can't clone target files.
+	};
+
+	// Returns the name of the /dir root a directory was found under, for notice_field::root. Empty for the files which
+	// a /files list names by path.
+	[[nodiscard]] inline std::wstring_view root_name(directory_argument const& Directories) noexcept
+	{
+		auto const root = Directories.src.substr(0, Directories.rootLength);
+		return root.substr(root.find_last_of(L'\\') + 1);
+	}
+
+	// Returns the last component of a path, for notice_field::file.
+	[[nodiscard]] inline std::wstring_view file_name(std::wstring_view const Path) noexcept
+	{
+		return Path.substr(Path.find_last_of(L'\\') + 1);
+	}
+
+	// Returns the extended-length form of a path: absolute, normalised, and prefixed with "\\?\" (or
+	// "\\?\UNC\" for a share). The file system APIs pass such paths through without parsing them again, and paths
+	// built from them aren't limited to MAX_PATH. An empty path is the current directory.
+	[[nodiscard]] inline std::wstring extended_length_path(std::wstring_view const Path)
+	{
+		std::wstring const relative(Path.empty() ? L"." : Path);
+		std::wstring full(MAX_PATH, L'\0');
+		for (;;)
+		{
+			auto const length = GetFullPathNameW(relative.data(), static_cast<DWORD>(full.size()), full.data(), nullptr);
+			if (length == 0)
+			{
+				wdul::throw_last_error("Could not get the full path of a file or directory");
+			}
+			if (length < full.size())
+			{
+				// The length of the path, without the terminating null character.
+				full.resize(length);
+				break;
+			}
+			// The length of the buffer needed, including the terminating null character.
+			full.resize(length);
+		}
+		if (full.starts_with(L"\\\\?\\"))
+		{
+			return full;
+		}
+		if (full.starts_with(L"\\\\"))
+		{
+			return L"\\\\?\\UNC\\" + full.substr(2);
+		}
+		return L"\\\\?\\" + full;
+	}
+
+	// Returns the Win32 form of an extended-length path from extended_length_path, which GetFullPathNameW parses and
+	// normalises again.
+	[[nodiscard]] inline std::wstring win32_path(std::wstring_view const Path)
+	{
+		if (Path.starts_with(L"\\\\?\\UNC\\"))
+		{
+			return L"\\\\" + std::wstring(Path.substr(8));
+		}
+		if (Path.starts_with(L"\\\\?\\"))
+		{
+			return std::wstring(Path.substr(4));
+		}
+		return std::wstring(Path);
+	}
+
+	// Returns the cluster size of the volume holding both directories if it supports block cloning (ReFS, including
+	// Dev Drive), or 0 if it doesn't or if they are on different volumes. Empty paths are the current directory.
+	[[nodiscard]] inline std::uint32_t block_clone_cluster_size(std::wstring_view const SrcDirectory, std::wstring_view const DstDirectory) noexcept
+	{
+		auto const open = [](std::wstring_view const Directory)
+		{
+			return unique_handle(CreateFileW(Directory.empty() ? L"." : Directory.data(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr));
+		};
+		auto const src = open(SrcDirectory);
+		auto const dst = open(DstDirectory);
+		DWORD srcSerial, dstSerial, flags;
+		if (!src || !dst ||
+			!GetVolumeInformationByHandleW(src.get(), nullptr, 0, &srcSerial, nullptr, nullptr, nullptr, 0) ||
+			!GetVolumeInformationByHandleW(dst.get(), nullptr, 0, &dstSerial, nullptr, &flags, nullptr, 0) ||
+			srcSerial != dstSerial || !(flags & FILE_SUPPORTS_BLOCK_REFCOUNTING))
+		{
+			return 0;
+		}
+		FSCTL_GET_INTEGRITY_INFORMATION_BUFFER integrity;
+		DWORD returned;
+		if (!DeviceIoControl(dst.get(), FSCTL_GET_INTEGRITY_INFORMATION, nullptr, 0, &integrity, sizeof(integrity), &returned, nullptr))
+		{
+			return 0;
+		}
+		return integrity.ClusterSizeInBytes;
+	}
+
+	using copynotice::overwrite_policy;
+	using copynotice::file_status;
+	using copynotice::run_totals;
+
+	// A set of file extensions, matched case-insensitively against file names.
+	class extension_set
+	{
+	public:
+		static constexpr std::size_t npos = SIZE_MAX;
+
+		// Replaces the contents of the set. Values[i] is the value of Extensions[i]. Duplicate extensions are removed,
+		// keeping the first.
+		void assign(std::vector<std::wstring> const& Extensions, std::vector<std::size_t> const& Values)
+		{
+			mExtensions.clear();
+			for (std::size_t i = 0; i < Extensions.size(); ++i)
+			{
+				auto const& extension = Extensions[i];
+				if (std::none_of(mExtensions.begin(), mExtensions.end(), [&](entry const& Existing) { return equal(Existing.extension, extension); }))
+				{
+					mExtensions.push_back({ extension, Values[i] });
+				}
+			}
+			// Sort by length so that find() can stop at the first extension longer than the candidate.
+			std::stable_sort(mExtensions.begin(), mExtensions.end(), [](entry const& A, entry const& B) { return A.extension.size() < B.extension.size(); });
+		}
+
+		// Returns the value of the file name's extension (the text after its last dot), or npos if it is not in the set.
+		[[nodiscard]] std::size_t find(std::wstring_view const Fname) const noexcept
+		{
+			auto const dotPos = Fname.rfind(L'.');
+			if (dotPos == Fname.npos)
+			{
+				return npos;
+			}
+			auto const extension = Fname.substr(dotPos + 1);
+			for (auto const& candidate : mExtensions)
+			{
+				if (candidate.extension.size() > extension.size())
+				{
+					break;
+				}
+				if (candidate.extension.size() == extension.size() && equal(candidate.extension, extension))
+				{
+					return candidate.value;
+				}
+			}
+			return npos;
+		}
+
+		// Returns true if the file name's extension is in the set.
+		[[nodiscard]] bool matches(std::wstring_view const Fname) const noexcept
+		{
+			return find(Fname) != npos;
+		}
+
+	private:
+		// Compares two strings the same way the file system compares file names.
+		static bool equal(std::wstring_view const A, std::wstring_view const B) noexcept
+		{
+			return CompareStringOrdinal(A.data(), static_cast<int>(A.size()), B.data(), static_cast<int>(B.size()), TRUE) == CSTR_EQUAL;
+		}
+
+		struct entry
+		{
+			std::wstring extension;
+			std::size_t value;
+		};
+
+		std::vector<entry> mExtensions;
+	};
+
+	// An append-only record of the target files which a run has finished, so that /resume can skip them once the run has
+	// been interrupted. Records are buffered and appended in batches, at least every flush_interval, so a run which is
+	// killed loses at most the files it finished since the last batch. Safe to use from several threads at once.
+	class checkpoint_journal
+	{
+	public:
+		// No copy/move.
+		checkpoint_journal(checkpoint_journal const&) = delete;
+		checkpoint_journal(checkpoint_journal&&) = delete;
+		checkpoint_journal& operator=(checkpoint_journal const&) = delete;
+		checkpoint_journal& operator=(checkpoint_journal&&) = delete;
+
+		// Opens the journal at Path, creating it if it doesn't exist. The files recorded by the interrupted run are
+		// loaded if it ran with the same RunHash; otherwise, the journal is started afresh.
+		checkpoint_journal(std::wstring Path, std::uint64_t const RunHash);
+
+		// Appends the records which are still buffered, as when a run is stopped by an error.
+		~checkpoint_journal()
+		{
+			try
+			{
+				flush();
+			}
+			catch (...)
+			{
+			}
+		}
+
+		// Returns the number of target files which the interrupted run finished.
+		[[nodiscard]] std::size_t previous_count() const noexcept { return mPrevious.size(); }
+
+		// Returns true if the interrupted run finished the target file. The previous records are never changed, so this
+		// doesn't lock.
+		[[nodiscard]] bool contains(std::wstring const& SrcPath) const { return mPrevious.contains(SrcPath); }
+
+		// Records a finished target file. The buffered records are appended once enough of them have built up, or once
+		// flush_interval has passed since the last batch.
+		void record(std::wstring_view const SrcPath);
+
+		// Appends the buffered records to the journal.
+		void flush()
+		{
+			std::scoped_lock const lock(mMutex);
+			flush_locked();
+		}
+
+		// Deletes the journal once its run has finished every target file, so that the next run starts afresh.
+		void finish();
+
+	private:
+		static constexpr char magic[8] = { 'C', 'N', 'J', 'O', 'U', 'R', 'N', '1' };
+		static constexpr std::size_t flush_size = 64 * 1024;
+		static constexpr std::chrono::seconds flush_interval{ 1 };
+
+		void flush_locked();
+
+		std::wstring mPath;
+		wdul::file_handle mFile;
+		std::unordered_set<std::wstring, path_hash, path_equal> mPrevious;
+		std::vector<std::uint8_t> mPending; // records not yet appended.
+		std::chrono::steady_clock::time_point mLastFlush = std::chrono::steady_clock::now();
+		std::mutex mMutex;
+	};
+
+	checkpoint_journal::checkpoint_journal(std::wstring Path, std::uint64_t const RunHash) :
+		mPath(std::move(Path))
+	{
+		// Layout: magic, u64 run hash, then for each finished file: u32 path length, path (UTF-16). A record cut off by
+		// an interrupted append is dropped, and the next append overwrites it.
+		std::uint64_t validSize = 0;
+		if (wdul::fexists(mPath.data()))
+		{
+			auto file = wdul::fopen(mPath.data(), wdul::file_open_mode::open_existing, FILE_FLAG_SEQUENTIAL_SCAN, wdul::generic_access::read, wdul::file_share_mode::read);
+			auto const size = wdul::fgetsize(file.get());
+			std::vector<std::uint8_t> data(static_cast<std::size_t>(std::min<std::uint64_t>(size, 0xFFFFFFFF)));
+			for (std::size_t offset = 0; offset != data.size();)
+			{
+				auto const readSize = wdul::fread(file.get(), static_cast<std::uint32_t>(data.size() - offset), data.data() + offset);
+				if (readSize == 0)
+				{
+					data.resize(offset);
+					break;
+				}
+				offset += readSize;
+			}
+
+			std::size_t pos = 0;
+			auto const take = [&](void* const Out, std::size_t const Size)
+			{
+				if (data.size() - pos < Size)
+				{
+					return false;
+				}
+				std::memcpy(Out, data.data() + pos, Size);
+				pos += Size;
+				return true;
+			};
+			char fileMagic[sizeof(magic)];
+			std::uint64_t fileHash;
+			if (take(fileMagic, sizeof(fileMagic)) && std::memcmp(fileMagic, magic, sizeof(magic)) == 0 && take(&fileHash, sizeof(fileHash)) && fileHash == RunHash)
+			{
+				validSize = pos;
+				std::uint32_t pathLength;
+				while (take(&pathLength, sizeof(pathLength)) && (data.size() - pos) / sizeof(wchar_t) >= pathLength)
+				{
+					std::wstring path(pathLength, L'\0');
+					take(path.data(), pathLength * sizeof(wchar_t));
+					mPrevious.insert(std::move(path));
+					validSize = pos;
+				}
+			}
+		}
+
+		if (validSize != 0)
+		{
+			mFile = wdul::fopen(mPath.data(), wdul::file_open_mode::open_existing, FILE_ATTRIBUTE_NORMAL, wdul::generic_access::write, wdul::file_share_mode::read);
+			LARGE_INTEGER end;
+			end.QuadPart = static_cast<LONGLONG>(validSize);
+			wdul::check_bool(SetFilePointerEx(mFile.get(), end, nullptr, FILE_BEGIN));
+			wdul::check_bool(SetEndOfFile(mFile.get()));
+			return;
+		}
+		mFile = wdul::fopen(mPath.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_NORMAL, wdul::generic_access::write, wdul::file_share_mode::read);
+		std::uint8_t header[sizeof(magic) + sizeof(RunHash)];
+		std::memcpy(header, magic, sizeof(magic));
+		std::memcpy(header + sizeof(magic), &RunHash, sizeof(RunHash));
+		write_all(mFile.get(), sizeof(header), header);
+	}
+
+	void checkpoint_journal::record(std::wstring_view const SrcPath)
+	{
+		auto const pathLength = static_cast<std::uint32_t>(SrcPath.size());
+		auto const bytes = reinterpret_cast<std::uint8_t const*>(SrcPath.data());
+		std::scoped_lock const lock(mMutex);
+		mPending.insert(mPending.end(), reinterpret_cast<std::uint8_t const*>(&pathLength), reinterpret_cast<std::uint8_t const*>(&pathLength + 1));
+		mPending.insert(mPending.end(), bytes, bytes + SrcPath.size() * sizeof(wchar_t));
+		if (mPending.size() >= flush_size || std::chrono::steady_clock::now() - mLastFlush >= flush_interval)
+		{
+			flush_locked();
+		}
+	}
+
+	void checkpoint_journal::flush_locked()
+	{
+		if (!mPending.empty() && mFile)
+		{
+			write_all(mFile.get(), mPending.size(), mPending.data());
+		}
+		mPending.clear();
+		mLastFlush = std::chrono::steady_clock::now();
+	}
+
+	void checkpoint_journal::finish()
+	{
+		std::scoped_lock const lock(mMutex);
+		mPending.clear();
+		mFile.close();
+		DeleteFileW(mPath.data());
+	}
+
+	// A fixed-capacity FIFO queue shared between producer and consumer threads. Items are exchanged with swap rather
+	// than moved, so that storage owned by an item, such as a string's buffer, cycles between the producer, the queue
+	// and the consumers instead of being allocated for every item.
+	template <class T>
+	class bounded_queue
+	{
+	public:
+		// No copy/move.
+		bounded_queue(bounded_queue const&) = delete;
+		bounded_queue(bounded_queue&&) = delete;
+		bounded_queue& operator=(bounded_queue const&) = delete;
+		bounded_queue& operator=(bounded_queue&&) = delete;
+
+		// With a ByteCapacity, the queue is also full once the items in it take that many bytes, as measured by
+		// footprint(T const&). A single item is always let in, however large.
+		explicit bounded_queue(std::size_t const Capacity, std::size_t const ByteCapacity = SIZE_MAX) : mItems(Capacity), mByteCapacity(ByteCapacity) {}
+
+		// Adds an item to the back of the queue, blocking while the queue is full. Item is left holding a previously
+		// popped item, whose storage can be reused for the next push.
+		// Returns false if the queue was closed, in which case the item is discarded.
+		bool push(T& Item)
+		{
+			auto const bytes = mByteCapacity == SIZE_MAX ? 0 : footprint(Item);
+			std::unique_lock lock(mMutex);
+			mNotFull.wait(lock, [&] { return mClosed || (mCount < mItems.size() && (mCount == 0 || mBytes + bytes <= mByteCapacity)); });
+			if (mClosed)
+			{
+				return false;
+			}
+			using std::swap;
+			swap(mItems[(mHead + mCount) % mItems.size()], Item);
+			++mCount;
+			mBytes += bytes;
+			lock.unlock();
+			mNotEmpty.notify_one();
+			return true;
+		}
+
+		enum class pop_result : std::uint8_t { item, empty, closed };
+
+		// Removes an item from the front of the queue if there is one, without blocking. The previous value of Item is
+		// kept by the queue for reuse.
+		// Returns pop_result::closed once the queue is closed and no items remain.
+		pop_result try_pop(T& Item)
+		{
+			std::unique_lock lock(mMutex);
+			if (mCount == 0)
+			{
+				return mClosed ? pop_result::closed : pop_result::empty;
+			}
+			take_front(Item);
+			lock.unlock();
+			mNotFull.notify_one();
+			return pop_result::item;
+		}
+
+		// Removes an item from the front of the queue, blocking while the queue is empty and open. The previous value of
+		// Item is kept by the queue for reuse.
+		// Returns false once the queue is closed and no items remain.
+		bool pop(T& Item)
+		{
+			std::unique_lock lock(mMutex);
+			mNotEmpty.wait(lock, [this] { return mClosed || mCount != 0; });
+			if (mCount == 0)
+			{
+				return false;
+			}
+			take_front(Item);
+			lock.unlock();
+			mNotFull.notify_one();
+			return true;
+		}
+
+		// Stops further pushes. Items already in the queue can still be popped.
+		void close()
+		{
+			{
+				std::scoped_lock const lock(mMutex);
+				mClosed = true;
+			}
+			mNotFull.notify_all();
+			mNotEmpty.notify_all();
+		}
+
+		// Stops further pushes and discards the items in the queue.
+		void cancel()
+		{
+			{
+				std::scoped_lock const lock(mMutex);
+				mClosed = true;
+				mCount = 0;
+				mBytes = 0;
+			}
+			mNotFull.notify_all();
+			mNotEmpty.notify_all();
+		}
+
+	private:
+		void take_front(T& Item)
+		{
+			using std::swap;
+			swap(mItems[mHead], Item);
+			mHead = (mHead + 1) % mItems.size();
+			--mCount;
+			if (mByteCapacity != SIZE_MAX) mBytes -= footprint(Item);
+		}
+
+		std::mutex mMutex;
+		std::condition_variable mNotFull;
+		std::condition_variable mNotEmpty;
+		std::vector<T> mItems; // a ring buffer of mCount items starting at mHead.
+		std::size_t mHead = 0;
+		std::size_t mCount = 0;
+		std::size_t mByteCapacity;
+		std::size_t mBytes = 0; // the footprint of the items in the queue, if mByteCapacity is set.
+		bool mClosed = false;
+	};
+
+	class buffer_pool;
+
+	// Gives a buffer back to the buffer_pool it was taken from, or frees it if it belongs to no pool.
+	struct return_buffer
+	{
+		buffer_pool* pool = nullptr;
+
+		void operator()(std::uint8_t* const Buffer) const noexcept;
+	};
+
+	// A buffer which is freed, or given back to its buffer_pool, once it is no longer needed.
+	using pooled_buffer = std::unique_ptr<std::uint8_t[], return_buffer>;
+
+	// Allocates a buffer which belongs to no pool.
+	[[nodiscard]] inline pooled_buffer allocate_buffer(std::size_t const Size)
+	{
+		return pooled_buffer(new std::uint8_t[Size]);
+	}
+
+	// Hands out buffers of one size from a byte budget, for /maxmem. A buffer given back is handed out again for the
+	// next file instead of being freed, and no more buffers are allocated than the budget holds. Once they are all in
+	// use, acquire blocks, which holds back the thread taking new files until a file in flight is finished. Safe to
+	// use from several threads at once.
+	class buffer_pool
+	{
+	public:
+		// No copy/move.
+		buffer_pool(buffer_pool const&) = delete;
+		buffer_pool(buffer_pool&&) = delete;
+		buffer_pool& operator=(buffer_pool const&) = delete;
+		buffer_pool& operator=(buffer_pool&&) = delete;
+
+		// Budget must hold at least one buffer.
+		buffer_pool(std::size_t const BufferSize, std::uint64_t const Budget) :
+			mBufferSize(BufferSize),
+			mMaxBuffers(static_cast<std::size_t>(Budget / BufferSize))
+		{
+			// Giving a buffer back must not allocate.
+			mFree.reserve(mMaxBuffers);
+		}
+
+		~buffer_pool()
+		{
+			for (auto const buffer : mFree)
+			{
+				delete[] buffer;
+			}
+		}
+
+		[[nodiscard]] std::size_t buffer_size() const noexcept { return mBufferSize; }
+
+		// Takes a buffer, waiting while every buffer the budget holds is in use.
+		[[nodiscard]] pooled_buffer acquire()
+		{
+			std::unique_lock lock(mMutex);
+			mAvailable.wait(lock, [this] { return !mFree.empty() || mAllocated < mMaxBuffers; });
+			return take(lock);
+		}
+
+		// Takes a buffer if one is available without waiting, or else returns no buffer.
+		[[nodiscard]] pooled_buffer try_acquire()
+		{
+			std::unique_lock lock(mMutex);
+			if (mFree.empty() && mAllocated == mMaxBuffers)
+			{
+				return {};
+			}
+			return take(lock);
+		}
+
+	private:
+		friend return_buffer;
+
+		pooled_buffer take(std::unique_lock<std::mutex>& Lock)
+		{
+			if (!mFree.empty())
+			{
+				auto const buffer = mFree.back();
+				mFree.pop_back();
+				return pooled_buffer(buffer, return_buffer{ this });
+			}
+			++mAllocated;
+			Lock.unlock();
+			try
+			{
+				return pooled_buffer(new std::uint8_t[mBufferSize], return_buffer{ this });
+			}
+			catch (...)
+			{
+				Lock.lock();
+				--mAllocated;
+				throw;
+			}
+		}
+
+		void release(std::uint8_t* const Buffer) noexcept
+		{
+			{
+				std::scoped_lock const lock(mMutex);
+				mFree.push_back(Buffer);
+			}
+			mAvailable.notify_one();
+		}
+
+		std::size_t mBufferSize;
+		std::size_t mMaxBuffers;
+		std::size_t mAllocated = 0;
+		std::vector<std::uint8_t*> mFree; // buffers which have been given back.
+		std::mutex mMutex;
+		std::condition_variable mAvailable;
+	};
+
+	inline void return_buffer::operator()(std::uint8_t* const Buffer) const noexcept
+	{
+		if (pool)
+		{
+			pool->release(Buffer);
+		}
+		else
+		{
+			delete[] Buffer;
+		}
+	}
+
+	// A target file waiting to be processed by a worker thread.
+	struct file_task
+	{
+		directory_argument const* directory = nullptr; // an element of instance::mDirectories.
+		std::wstring name;
+		std::wstring dstName; // the name of the output file, if a /files list names it; otherwise it is name.
+		file_attributes attributes;
+	};
+
+	// Returns the bytes a file_task takes in a bounded_queue, counted against /maxmem.
+	[[nodiscard]] inline std::size_t footprint(file_task const& Task) noexcept
+	{
+		return sizeof(Task) + (Task.name.capacity() + Task.dstName.capacity()) * sizeof(wchar_t);
+	}
+
+	// Pushes a target file found by instance::find_targets to a queue. Each producing thread keeps its own file_task,
+	// whose name buffers are swapped with ones from the queue, so that pushing doesn't allocate once the buffers have
+	// grown.
+	inline bool push_task(bounded_queue<file_task>& Queue, directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes)
+	{
+		thread_local file_task task;
+		task.directory = &Directories;
+		task.name.assign(Fname);
+		task.dstName.assign(DstFname);
+		task.attributes = Attributes;
+		return Queue.push(task);
+	}
+
+	// The paths of a target file and of its output file. Reused from file to file: the directory prefixes are only
+	// rebuilt when the directory changes, and otherwise just the file name is replaced.
+	struct target_paths
+	{
+		std::wstring src;
+		std::wstring dst;
+		std::wstring manifest; // the source path relative to its /dir argument, in /incremental mode.
+		std::wstring temp;     // the temporary output file which replaces src, in /inplace mode.
+		directory_argument const* directory = nullptr; // the directory src and dst were last built for.
+		std::size_t srcPrefixLength = 0;
+		std::size_t dstPrefixLength = 0;
+		std::wstring createdDirectory; // the output directory last created for a /files list.
+	};
+
+	// The phases of processing a run which /stats times.
+	enum class stats_phase : std::uint8_t
+	{
+		enumerate,    // FindFirstFile and FindNextFile calls.
+		open,         // opening target files and creating output files.
+		scan,         // reading the first block and finding the end of the leading comment lines.
+		write_header, // writing the header together with the first part of the body.
+		copy_body,    // copying the rest of the body, or a whole file which is already stamped.
+		count
+	};
+
+	inline constexpr std::wstring_view stats_phase_names[] = { L"enumerate", L"open", L"scan", L"write_header", L"copy_body" };
+	static_assert(std::size(stats_phase_names) == static_cast<std::size_t>(stats_phase::count));
+
+	// Cumulative counters collected with /stats. Each thread collects its own, which are merged when it finishes.
+	struct run_stats
+	{
+		static constexpr std::size_t slowest_count = 10;
+
+		struct file_time
+		{
+			std::uint64_t nanoseconds;
+			std::wstring path;
+		};
+
+		std::uint64_t phaseNanoseconds[static_cast<std::size_t>(stats_phase::count)] = {};
+		std::uint64_t bytesRead = 0;
+		std::uint64_t bytesWritten = 0;
+		std::uint64_t bytesCloned = 0; // body bytes shared with target files by block cloning rather than written.
+		std::uint64_t findCalls = 0;
+		std::uint64_t openCalls = 0;
+		std::uint64_t readCalls = 0;
+		std::uint64_t writeCalls = 0;
+		std::uint64_t cloneCalls = 0;
+		std::uint64_t files = 0;
+		std::vector<file_time> slowest; // sorted by descending time; at most slowest_count entries.
+
+		// Counts a processed target file, and keeps its path if it is one of the slowest files so far.
+		void add_file(std::uint64_t const Nanoseconds, std::wstring_view const Directory, std::wstring_view const Fname)
+		{
+			++files;
+			if (slowest.size() == slowest_count && Nanoseconds <= slowest.back().nanoseconds)
+			{
+				return;
+			}
+			std::wstring path(Directory);
+			if (!path.empty()) path += L'\\';
+			path += Fname;
+			add_slow({ Nanoseconds, std::move(path) });
+		}
+
+		run_stats& operator+=(run_stats const& Other)
+		{
+			for (std::size_t i = 0; i < std::size(phaseNanoseconds); ++i)
+			{
+				phaseNanoseconds[i] += Other.phaseNanoseconds[i];
+			}
+			bytesRead += Other.bytesRead;
+			bytesWritten += Other.bytesWritten;
+			bytesCloned += Other.bytesCloned;
+			findCalls += Other.findCalls;
+			openCalls += Other.openCalls;
+			readCalls += Other.readCalls;
+			writeCalls += Other.writeCalls;
+			cloneCalls += Other.cloneCalls;
+			files += Other.files;
+			for (auto const& file : Other.slowest)
+			{
+				add_slow(file_time(file));
+			}
+			return *this;
+		}
+
+	private:
+		void add_slow(file_time&& File)
+		{
+			auto const it = std::upper_bound(slowest.begin(), slowest.end(), File.nanoseconds, [](std::uint64_t const Nanoseconds, file_time const& Other)
+			{
+				return Nanoseconds > Other.nanoseconds;
+			});
+			if (it - slowest.begin() >= static_cast<std::ptrdiff_t>(slowest_count))
+			{
+				return;
+			}
+			slowest.insert(it, std::move(File));
+			if (slowest.size() > slowest_count) slowest.pop_back();
+		}
+	};
+
+	// Adds elapsed time to one phase of a run_stats at a time. Does nothing if there is no run_stats, so that runs
+	// without /stats don't read the clock.
+	class phase_timer
+	{
+	public:
+		phase_timer(run_stats* const Stats, stats_phase const Phase) noexcept : mStats(Stats), mPhase(Phase)
+		{
+			if (mStats) mStart = std::chrono::steady_clock::now();
+		}
+
+		phase_timer(phase_timer const&) = delete;
+		phase_timer(phase_timer&&) = delete;
+		phase_timer& operator=(phase_timer const&) = delete;
+		phase_timer& operator=(phase_timer&&) = delete;
+
+		~phase_timer()
+		{
+			if (mStats) add(std::chrono::steady_clock::now());
+		}
+
+		// Ends the current phase and starts timing Phase.
+		void next(stats_phase const Phase) noexcept
+		{
+			if (mStats)
+			{
+				auto const now = std::chrono::steady_clock::now();
+				add(now);
+				mStart = now;
+			}
+			mPhase = Phase;
+		}
+
+		// Ends the current phase without starting another one.
+		void stop() noexcept
+		{
+			if (mStats)
+			{
+				add(std::chrono::steady_clock::now());
+				mStats = nullptr;
+			}
+		}
+
+	private:
+		void add(std::chrono::steady_clock::time_point const Now) noexcept
+		{
+			mStats->phaseNanoseconds[static_cast<std::size_t>(mPhase)] += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Now - mStart).count());
+		}
+
+		run_stats* mStats;
+		stats_phase mPhase;
+		std::chrono::steady_clock::time_point mStart;
+	};
+
+	// How /log lists the processed target files once a run is done.
+	enum class log_order : std::uint8_t
+	{
+		none,     // only the totals are printed.
+		unsorted, // in the order each thread finished them, thread by thread.
+		sorted,   // by source path, so that the listing is the same whichever engine ran.
+	};
+
+	// A processed target file, as recorded for /log. Its source path is kept in the paths of its file_log.
+	struct file_record
+	{
+		std::size_t pathOffset;
+		std::uint32_t pathLength;
+		std::uint32_t microseconds;
+		std::uint64_t bytes; // the size of the target file.
+		file_status status;
+	};
+
+	// The target files processed by one thread, recorded without any locking and merged once the thread finishes.
+	struct file_log
+	{
+		std::wstring paths; // the source paths of every record, concatenated.
+		std::vector<file_record> records;
+
+		void add(std::wstring_view const Path, file_status const Status, std::uint64_t const Bytes, std::uint32_t const Microseconds)
+		{
+			records.push_back({ paths.size(), static_cast<std::uint32_t>(Path.size()), Microseconds, Bytes, Status });
+			paths += Path;
+		}
+
+		[[nodiscard]] std::wstring_view path(file_record const& Record) const noexcept
+		{
+			return std::wstring_view(paths).substr(Record.pathOffset, Record.pathLength);
+		}
+	};
+
+	// State owned by a thread that processes target files. Reused from file to file.
+	struct worker_context
+	{
+		// Allocated on first use, or taken from the /maxmem pool for each file. Holds room for the header followed by
+		// copy_buffer_size bytes of file data.
+		pooled_buffer copyBuffer;
+		// Allocated on first use, aligned to unbuffered_alignment. Holds two unbuffered_block_size blocks: one the target
+		// file is read into, and one the output file is assembled in.
+		std::unique_ptr<std::uint8_t[], aligned_delete> unbufferedBuffer;
+		std::vector<std::uint32_t> latencies; // microseconds taken by each file, while the benchmark records them.
+		run_stats stats; // counters for /stats.
+		file_log log; // records for /log.
+		target_paths paths;
+		std::u8string header; // the header of the current target file, if the notice has placeholders.
+	};
+
+	// A target file being copied by the overlapped I/O engine. At most one read or write is in flight per file.
+	struct async_file
+	{
+		OVERLAPPED overlapped;
+		unique_handle src;
+		unique_handle dst;
+		file_task task;
+		target_paths paths;
+		pooled_buffer buffer; // reserves room for the header, then async_block_size bytes of data.
+		HANDLE port;               // the I/O completion port both handles are associated with.
+		std::uint64_t size;        // the size of the source file.
+		std::uint64_t readOffset;  // the source file offset of the next read.
+		std::uint64_t writeOffset; // the destination file offset of the next write.
+		bool writing;              // true if the operation in flight is a write, false if it is a read.
+		bool pending = false;      // true while an operation is in flight.
+		file_status status;        // the outcome, once the file is finished.
+		std::chrono::steady_clock::time_point start; // when the file was started, for latency measurements.
+	};
+
+	// The shape of the synthetic tree generated by /bench.
+	struct bench_spec
+	{
+		std::uint32_t files = 2000;
+		std::uint32_t depth = 3;
+		std::uint32_t fanout = 4;
+		std::uint32_t minSize = 256;
+		std::uint32_t maxSize = 256 * 1024;
+		std::uint32_t stampedPercent = 50; // the share of files that already start with the header.
+		std::uint32_t runs = 3;
+	};
+
+	// Core program methods, manages program state.
+	class instance
+	{
+	public:
+		// No copy/move.
+		instance(instance const&) = delete;
+		instance(instance&&) = delete;
+		instance& operator=(instance const&) = delete;
+		instance& operator=(instance&&) = delete;
+
+		instance()
+		{
+			mCons.write(L"\x1b[1;4;32mcopynotice (Source Code Notice Writer) v1.0.1\x1b[0;90m\nA tool by Will Daisey\x1b[0m\n");
+		}
+
+		// Creates an instance for a copynotice::batch, whose output goes to the sink set by redirect.
+		explicit instance(console::detached_t) :
+			mCons(console::detached)
+		{
+		}
+
+		void report_exception(std::wstring_view const What)
+		{
+			mCons.write(L"\x1b[0;1;31m").write(What).write(L"\n");
+		}
+
+		// Converts the command line to program arguments.
+		// Returns true on success, false on failure.
+		[[nodiscard]] bool init(int const ArgC, _In_reads_(ArgC) wchar_t** const ArgV);
+
+		// Sets the options of a copynotice::batch, as init sets them from the command line, and renders the headers.
+		// Returns true on success, false on failure.
+		[[nodiscard]] bool configure(copynotice::batch_config const& Config);
+
+		// Sets the function which receives the output of an instance created for a copynotice::batch.
+		void redirect(std::function<void(std::wstring_view)> Sink)
+		{
+			mCons.redirect(std::move(Sink));
+		}
+
+		// Processes the target files under Roots for a copynotice::batch, with the given overwrite policy, passing the
+		// outcome of each file to Callbacks. Returns false if a root is invalid.
+		[[nodiscard]] bool run_batch(std::span<copynotice::batch_root const> const Roots, copynotice::batch_callbacks const& Callbacks, overwrite_policy const Overwrite,
+			copynotice::batch_result& Result);
+
+		// Executes the program. Returns the outcomes of the target files.
+		run_totals execute();
+
+		// Runs the benchmark if /bench was given, otherwise processes the target directories, and then keeps watching
+		// them if /watch was given. Returns the exit code: 2 if /check found target files which need stamping, else 0.
+		int run()
+		{
+			if (mBench)
+			{
+				run_benchmark();
+				return 0;
+			}
+			auto const totals = execute();
+			if (mWatch) watch();
+			return mCheck && totals.missing + totals.stale != 0 ? 2 : 0;
+		}
+
+	private:
+		// Checks the combination of options, once init or configure has set them all, and renders the header of every
+		// comment syntax. Returns false if the options are invalid.
+		[[nodiscard]] bool finish_options();
+
+		// Checks the /dir arguments in mDirectories, converts them to extended-length paths, and creates missing output
+		// directories and the manifests of /incremental. Returns false if an argument is invalid.
+		[[nodiscard]] bool open_roots();
+
+		// Checks the src or dst path of a /dir argument, which is named by Subargument in errors. Returns false if the
+		// path has a trailing slash or contains an illegal character. An empty path is the current directory.
+		[[nodiscard]] bool check_directory_path(std::wstring_view const Path, std::wstring_view const Subargument);
+
+		// Adds a target file extension with the default comment syntax. Returns false if the extension is invalid.
+		[[nodiscard]] bool add_extension(std::wstring_view const Extension);
+
+		// Parses the subargument of /syntax: a line comment prefix such as "// ", or the opening and closing tokens of a
+		// block comment separated by a space, such as "/* */". Returns false if the subargument is invalid.
+		[[nodiscard]] bool parse_syntax(std::wstring_view const Subargument, comment_syntax& Syntax);
+
+		// Reads a /syntaxf file, which maps extensions to comment syntaxes with lines of the form "ext=syntax".
+		[[nodiscard]] bool read_syntax_file(wchar_t const* const Fname);
+
+		// Returns the comment syntax of a target file. Files listed by /files may match no extension, and use the default.
+		[[nodiscard]] comment_syntax const& syntax_of(std::wstring_view const Fname) const noexcept
+		{
+			auto const syntax = mExtensionSet.find(Fname);
+			return mSyntaxes[syntax == extension_set::npos ? 0 : syntax];
+		}
+
+		// Scratch state of a thread enumerating directories.
+		struct walk_state
+		{
+			WIN32_FIND_DATAW findData;
+			std::wstring path; // the search string, then the path of each subdirectory found.
+			run_stats stats;
+		};
+
+		// Enumerates each target directory exactly once, calling OnFile(directory_argument const&, WIN32_FIND_DATAW const&)
+		// for each target file and OnDirectoryEnd(directory_argument const&, std::uint32_t targetFileCount) once the
+		// directory has been enumerated. If mRecurse is set, subdirectories found during the same pass are appended to
+		// mDirectories and enumerated in turn. Stops early if OnFile returns false.
+		// With more than one walker, directories are enumerated on Walkers threads at once, including the calling thread,
+		// and OnFile and OnDirectoryEnd must be thread-safe. Files are passed to OnFile as soon as they are found.
+		template <class FileFn, class DirectoryFn>
+		void walk(std::uint32_t const Walkers, FileFn&& OnFile, DirectoryFn&& OnDirectoryEnd);
+
+		// Enumerates one directory for walk, calling OnSubdirectory(std::wstring_view path, std::wstring_view name) for
+		// each subdirectory. Returns the number of target files, or std::nullopt if OnFile returned false.
+		template <class FileFn, class SubdirectoryFn>
+		std::optional<std::uint32_t> enumerate_directory(directory_argument const& Directories, walk_state& State, FileFn& OnFile, SubdirectoryFn&& OnSubdirectory);
+
+		// Calls OnFile(directory_argument const&, std::wstring_view fname, std::wstring_view dstFname, file_attributes const&)
+		// for each target file: the files of the /files list if there is one, reading it on the calling thread, or else
+		// the files found by walk, with an empty dstFname. Stops early if OnFile returns false.
+		template <class FileFn, class DirectoryFn>
+		void find_targets(std::uint32_t const Walkers, FileFn&& OnFile, DirectoryFn&& OnDirectoryEnd);
+
+		// Streams the /files list, calling OnEntry(directory_argument const&, std::wstring_view fname, std::wstring_view
+		// dstFname, std::wstring const& srcPath) for each listed file, until it returns false. Lines which name no
+		// output file are reported and skipped.
+		template <class EntryFn>
+		void read_file_list(EntryFn&& OnEntry);
+
+		// Creates the directory of an output file named by a /files list or found by watch, and any missing ancestors,
+		// unless it is the directory created last. Directories found by walk are created as they are found instead.
+		void create_output_directory(target_paths& Paths);
+
+		// Parses the subargument of /bench: comma-separated key=value pairs.
+		[[nodiscard]] bool parse_bench_spec(std::wstring_view Spec);
+
+		// Generates a synthetic tree, runs execute over it with each engine and reports throughput and latency.
+		void run_benchmark();
+
+		// Deletes a directory and everything in it.
+		void remove_tree(std::wstring const& Path);
+
+		// Moves the latencies and counters recorded by a worker into mLatencies and mRunStats.
+		void collect_measurements(worker_context& Context);
+
+		// Moves counters recorded by a thread into mRunStats.
+		void collect_stats(run_stats& Stats);
+
+		// Returns the counters of a worker if /stats is set, or nullptr to leave them untouched.
+		[[nodiscard]] run_stats* stats(worker_context& Context) const noexcept
+		{
+			return mStats ? &Context.stats : nullptr;
+		}
+
+		// Waits for target files under the /dir roots to change, and stamps the files which changed once changes stop for
+		// watch_debounce_milliseconds. Never returns, unless an error is thrown.
+		[[noreturn]] void watch();
+
+		// Fills mExistingOutputs by enumerating the destination roots, once per directory, or by looking up each output
+		// file of the /files list, which must then be read twice. With overwrite_policy::ask, asks once whether to
+		// overwrite the existing output files which a target file maps to, and sets mOverwrite to always or never.
+		void scan_outputs();
+
+		// Returns the existing output files which a target file found by walking the source roots maps to, as
+		// find_targets would find them, without creating any output directory.
+		std::vector<std::wstring_view> find_conflicts() const;
+
+		// Opens the /resume journal into mJournal. The journal belongs to runs with the same notices, mode, roots, /files
+		// list and extensions; one left by a run with different arguments is started afresh.
+		void open_journal();
+
+		// Prints the counters collected in mRunStats, and writes them to mStatsPath as JSON if it is set.
+		void report_stats(double const WallSeconds);
+
+		// Calls create_file and counts the file for the progress line and the /resume journal, recording the time it takes
+		// if mRecordLatency or mStats is set. Under /maxmem, the copy buffer goes back to the pool afterwards.
+		file_status process_file(directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes, worker_context& Context);
+
+		// Returns the bytes the queue of target files may take: its share of /maxmem, or SIZE_MAX without a budget.
+		[[nodiscard]] std::size_t queue_byte_capacity() const noexcept
+		{
+			return mMaxMemory == 0 ? SIZE_MAX : static_cast<std::size_t>(mMaxMemory / maxmem_queue_share);
+		}
+
+		// Processes every target file on mJobs worker threads. The calling thread enumerates the target files into a
+		// bounded queue which the workers consume.
+		run_totals execute_parallel();
+
+		// Copies target files with overlapped I/O, keeping up to mAsync files in flight at once. Completions are handled
+		// on the calling thread through an I/O completion port, while another thread enumerates the target files.
+		run_totals execute_async();
+
+		// Opens the files for an async_file and issues its first read.
+		// Returns true if an operation is in flight, or false if the file was finished without one.
+		bool start_async(async_file& File, HANDLE const Port, worker_context& Context, run_totals& Totals);
+
+		// Handles the completion of an async_file's operation and issues the next one.
+		// Returns true if an operation is in flight, or false if the file is finished.
+		bool continue_async(async_file& File, std::uint32_t const Transferred, worker_context& Context, run_totals& Totals);
+
+		// Returns true if the time each file takes is measured, for mRecordLatency, mStats, mLogOrder or a file callback.
+		[[nodiscard]] bool measures_files() const noexcept
+		{
+			return mRecordLatency || mStats || mLogOrder != log_order::none || (mCallbacks && mCallbacks->file);
+		}
+
+		// Records the time a target file took, and its outcome, in the measurements which are enabled.
+		void record_file(worker_context& Context, std::chrono::steady_clock::duration const Elapsed, directory_argument const& Directories, std::wstring_view const Fname,
+			std::wstring_view const SrcPath, file_status const Status, std::uint64_t const Size)
+		{
+			auto const microseconds = static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(Elapsed).count());
+			if (mRecordLatency) Context.latencies.push_back(microseconds);
+			if (mStats) Context.stats.add_file(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Elapsed).count()), Directories.src, Fname);
+			if (mLogOrder != log_order::none) Context.log.add(SrcPath, Status, Size, microseconds);
+			if (mCallbacks && mCallbacks->file) mCallbacks->file({ SrcPath, Status, Size, microseconds });
+		}
+
+		// Gives a context its copy buffer, unless it has one. Under /maxmem, the buffer is taken from mPool, waiting while
+		// the budget is used up, and process_file gives it back once the file is finished.
+		void acquire_copy_buffer(worker_context& Context)
+		{
+			if (!Context.copyBuffer)
+			{
+				Context.copyBuffer = mPool ? mPool->acquire() : allocate_buffer(mHeaderRoom + copy_buffer_size);
+			}
+		}
+
+		// Records a finished target file in the /resume journal, unless the interrupted run had already finished it.
+		void journal_file(std::wstring_view const SrcPath, file_status const Status)
+		{
+			if (mJournal && Status != file_status::resumed) mJournal->record(SrcPath);
+		}
+
+		// Counts a finished async_file for the progress line and the /resume journal, and records the time it took and
+		// its outcome if measures_files.
+		void record_finished(async_file const& File, worker_context& Context)
+		{
+			mProgress.add_file(File.task.attributes.size);
+			journal_file(File.paths.src, File.status);
+			if (measures_files())
+			{
+				record_file(Context, std::chrono::steady_clock::now() - File.start, *File.task.directory, File.task.name, File.paths.src, File.status, File.task.attributes.size);
+			}
+		}
+
+		// Prints the records which workers have merged into mLogs in mLogOrder, then discards them.
+		void print_log();
+
+		void issue_read(async_file& File);
+		void issue_write(async_file& File, std::uint8_t const* const Data, std::uint32_t const Size);
+
+		// Sets the paths of a target file and of its output file. The output file is named DstFname, or Fname if it is
+		// empty.
+		void build_paths(directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, target_paths& Paths) const;
+
+		// Decides, before either file is opened, whether the output file for a target file should be written. Files the
+		// interrupted run finished are skipped with /resume. In /incremental mode, the manifest is checked. The user is asked before an existing output file is overwritten.
+		// Returns the status of the target file if no output file should be written, or std::nullopt if it should.
+		std::optional<file_status> skip_output(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes);
+
+		// Creates the output file, writes the notice to it, and copies the rest of the source file to it.
+		// In /incremental mode, the output file is left untouched if the manifest shows it is already up to date.
+		// May be called from several worker threads at once.
+		file_status create_file(directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes, worker_context& Context);
+
+		// Reads the first block of a target file for /check, and returns whether it is up to date, missing the header or
+		// starts with a stale comment. Nothing is written.
+		file_status check_file(target_paths& Paths, worker_context& Context);
+
+		// Writes the output file for a target file, after skip_output has decided that it should be written.
+		file_status stamp_file(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes, worker_context& Context);
+
+		// The copy loop copynotice started with, kept as the baseline of /bench: the target file is read in 64 bytes at a
+		// time, line by line up to its first code line, and the header is written a line at a time. Only UTF-8 target
+		// files are handled, and the output file is written even if it would be identical to the target file.
+		file_status stamp_naive(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes, worker_context& Context);
+
+		// Creates the output file for a target file which is already stamped, so that the output file must be identical
+		// to it. The output file is a hard link to the target file with /link, or else a copy made by CopyFile, which
+		// can clone the file's blocks on volumes that support it.
+		file_status mirror_stamped(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes, worker_context& Context);
+
+		// With /link, deletes the output file of Paths before the target file is opened, since a previous run may have
+		// made it a hard link to the target file: opening it to write would truncate the target file, or fail with a
+		// sharing violation while the target file is open. Deleting the link leaves the target file untouched.
+		void unlink_output(target_paths const& Paths) const;
+
+		// Returns true if the start of a target file is already exactly its header, followed by the body.
+		// AtEnd specifies whether Head extends to the end of the file.
+		// Head starts after any byte order mark and is in the specified format, as is Header.
+		[[nodiscard]] bool is_stamped(std::span<std::uint8_t const> const Head, bool const AtEnd, comment_syntax const& Syntax, text_format const Format, std::u8string_view const Header) const noexcept;
+
+		// Records a newly written output file in the manifest of its destination root, if there is one.
+		void record_output(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes);
+
+		// Copies the source file, from its current file pointer to the end of the file, to the destination file, whose
+		// file pointer is at DstOffset. The destination file is first extended to its final size if mPresize is set.
+		// The source file is mapped into memory and written with as few writes as possible. If the source file cannot
+		// be mapped, the data is copied in large chunks through the context's copy buffer instead. With a CloneClusterSize
+		// other than 0, extents which stay cluster-aligned in the destination file are cloned instead of copied.
+		void copy_remainder(HANDLE const Src, HANDLE const Dst, std::uint64_t const DstOffset, std::uint32_t const CloneClusterSize, worker_context& Context);
+
+		// Clones Src from SrcOffset to its end into Dst at DstOffset, which must be congruent to SrcOffset modulo
+		// ClusterSize, copying the bytes up to the first cluster boundary. Returns false, having changed nothing, if the
+		// volume refuses to clone.
+		bool clone_remainder(HANDLE const Src, std::uint64_t const SrcOffset, std::uint64_t const Size, HANDLE const Dst, std::uint64_t const DstOffset, std::uint32_t const ClusterSize, worker_context& Context);
+
+		// Writes Head, then the source file from its current file pointer to the end of the file, to the destination
+		// file, which was opened with FILE_FLAG_NO_BUFFERING. The destination file is sized up front unless mPresize is
+		// off, and the source file is reopened to be read without buffering too, if its volume allows it.
+		void copy_unbuffered(HANDLE const Src, HANDLE const Dst, std::span<std::uint8_t const> Head, worker_context& Context);
+
+		console mCons;
+		bool mRecurse = false;
+		bool mVerbose = false;
+		bool mReplace = false;
+		bool mIncremental = false;
+		bool mLinkStamped = false; // already-stamped target files are hard-linked into the output directory.
+		bool mInPlace = false; // source files are rewritten instead of output files being written; every dst is empty.
+		bool mCheck = false; // target files are only classified, never written; implies mInPlace, so that no dst is used.
+		std::vector<comment_syntax> mSyntaxes{ comment_syntax{ u8"// " } }; // [0] is the default; the others belong to one extension each.
+		std::deque<directory_argument> mDirectories; // a deque so that references stay valid while subdirectories are appended.
+		string_arena mDirectoryPaths; // the paths of the subdirectories in mDirectories.
+		string_arena mRootPaths; // the extended-length paths of the /dir arguments, which outlive mDirectoryPaths.
+		std::size_t mRootDirectories = 0; // the number of /dir arguments, which come first in mDirectories.
+		bool mWatch = false;
+		bool mCreateOutputDirectories = false; // output directories may be missing, as files are found without walking their directories.
+		std::wstring_view mFileListPath; // the /files list, or "-" for standard input; empty if directories are searched.
+		directory_argument mListedFiles; // the directory of files which the /files list names by path: src and dst are empty.
+		std::vector<std::wstring> mExtensions;
+		std::vector<std::size_t> mExtensionSyntaxes; // the index in mSyntaxes of the syntax of each element of mExtensions.
+		extension_set mExtensionSet; // maps extensions to indices in mSyntaxes.
+		std::u8string mNotice;
+		std::size_t mHeaderRoom = 0; // the size of the longest header, which copy buffers reserve before the file data.
+		std::deque<stamp_manifest> mManifests; // one per /dir argument in /incremental mode.
+		overwrite_policy mOverwrite = overwrite_policy::ask;
+		std::unordered_map<std::wstring, std::uint64_t, path_hash, path_equal> mExistingOutputs; // output path to last write time, from scan_outputs.
+		bool mShowProgress = false; // the progress line is shown while a run is in progress, for /progress.
+		progress_line mProgress; // counts processed files for the status line while mShowProgress is set.
+		std::uint32_t mJobs = 0; // 0 to process files on the calling thread.
+		std::uint32_t mAsync = 0; // the number of files in flight with overlapped I/O, or 0 to use synchronous I/O.
+		bool mUseMapping = true; // copy_remainder maps source files; the benchmark turns this off to measure buffered copies.
+		bool mPresize = true; // output files are sized before their body is written; the benchmark turns this off to measure appends.
+		bool mNaive = false; // set by the benchmark's naive engine, to stamp each file with stamp_naive.
+		bool mBench = false;
+		bool mBenchKeep = false;
+		bench_spec mBenchSpec;
+		std::wstring mBenchRoot;
+		std::wstring mBenchEngines; // engine names separated by '+', or empty for every engine.
+		bool mRecordLatency = false;
+		std::vector<std::uint32_t> mLatencies;
+		bool mStats = false;
+		std::wstring mStatsPath; // the file to write the /stats counters to as JSON, or empty.
+		run_stats mRunStats;
+		log_order mLogOrder = log_order::none;
+		std::vector<file_log> mLogs; // one per thread which processed files, for /log.
+		std::uint64_t mMaxMemory = 0; // the /maxmem budget in bytes, or 0 for no budget.
+		std::optional<buffer_pool> mPool; // the buffers within mMaxMemory, once init has sized them.
+		std::wstring mResumePath; // the /resume journal, or empty.
+		std::optional<checkpoint_journal> mJournal; // open while execute runs with /resume.
+		std::mutex mMeasurementMutex; // guards mLatencies, mRunStats and mLogs while workers merge their measurements.
+		copynotice::batch_callbacks const* mCallbacks = nullptr; // the callbacks of the batch run in progress, if any.
+	};
+}
+
+int copynotice::run_command_line(int ArgCount, wchar_t** Args)
+{
+	program::instance instance;
+	try
+	{
+		if (!instance.init(ArgCount, Args))
+		{
+			return 1;
+		}
+		return instance.run();
+	}
+	catch (std::exception const& e)
+	{
+		instance.report_exception(wdul::utf8_to_utf16(reinterpret_cast<char8_t const*>(e.what())));
+		return 1;
+	}
+}
+
+copynotice::batch::batch(batch_config const& Config) :
+	mOverwrite(Config.overwrite),
+	mInstance(std::make_unique<program::instance>(program::console::detached))
+{
+	std::wstring errors;
+	mInstance->redirect([&](std::wstring_view const Line)
+	{
+		if (!errors.empty()) errors += L'\n';
+		errors += Line;
+	});
+	bool valid;
+	try
+	{
+		valid = mInstance->configure(Config);
+	}
+	catch (...)
+	{
+		mInstance->redirect({});
+		throw;
+	}
+	// Delivers the errors still buffered by the console to errors, which must not be referenced once this returns.
+	mInstance->redirect({});
+	if (!valid)
+	{
+		throw std::invalid_argument(reinterpret_cast<char const*>(wdul::utf16_to_utf8(errors).c_str()));
+	}
+}
+
+copynotice::batch::~batch() = default;
+
+copynotice::batch_result copynotice::batch::run(std::span<batch_root const> const Roots, batch_callbacks const& Callbacks)
+{
+	// Errors in the roots are thrown, as errors in the configuration are, as well as passed to Callbacks.
+	std::wstring errors;
+	mInstance->redirect([&](std::wstring_view const Line)
+	{
+		if (Line.starts_with(L"Error: "))
+		{
+			if (!errors.empty()) errors += L'\n';
+			errors += Line;
+		}
+		if (Callbacks.message) Callbacks.message(Line);
+	});
+	batch_result result;
+	bool valid;
+	try
+	{
+		valid = mInstance->run_batch(Roots, Callbacks, mOverwrite, result);
+	}
+	catch (...)
+	{
+		mInstance->redirect({});
+		throw;
+	}
+	// Delivers the lines still buffered by the console to errors and Callbacks, before either goes out of scope.
+	mInstance->redirect({});
+	if (!valid)
+	{
+		throw std::invalid_argument(reinterpret_cast<char const*>(wdul::utf16_to_utf8(errors).c_str()));
+	}
+	return result;
+}
+
+[[nodiscard]] bool program::instance::init(int const ArgC, _In_reads_(ArgC) wchar_t** const ArgV)
+{
+	if (ArgC < 2)
+	{
+		mCons.write(
+			L"\x1b[1;31mNo arguments specified.\n\n"
+			"\x1b[0;1;4mAvailable arguments:\x1b[24m\n"
+			"\x1b[1m/async     \x1b[34m[count]\x1b[0m Copies files with overlapped I/O, keeping [count] files in flight at once.\n"
+			"\x1b[1m/bench     \x1b[34m[spec]\x1b[0m Generates a synthetic tree and times each engine over it. spec: optional comma-separated keys, e.g. \"files=2000,depth=3,fanout=4,size=256-262144,stamped=50,runs=3,engines=naive+mapped+appended+buffered+jobs+async,dir=path,keep=1\".\n"
+			"\x1b[1m/check     \x1b[0mReports the target files which are missing the notice or start with a stale one, without writing anything. Only the start of each file is read. Exits with code 2 if any file needs stamping.\n"
+			"\x1b[1m/dir       \x1b[34m[src] [dst]\x1b[0m src: A path to a directory to search. dst: A path to a directory to place output files; omitted with /inplace or /check. You may use this argument multiple times.\n"
+			"\x1b[1m/ext       \x1b[34m[name]\x1b[0m A target file extension. You may use this argument multiple times.\n"
+			"\x1b[1m/files     \x1b[34m[name]\x1b[0m Stamps the target files listed in a UTF-8 text file, or in standard input if [name] is \"-\", instead of searching directories. Each line is \"src>dst\", or a path relative to the src of the only /dir argument. Listed files need not match an /ext.\n"
+			"\x1b[1m/incremental \x1b[0mSkips files which have not changed since the previous run. A manifest is kept in each output directory.\n"
+			"\x1b[1m/inplace   \x1b[0mStamps source files in place instead of writing output files. Files which already start with the notice are not rewritten.\n"
+			"\x1b[1m/jobs      \x1b[34m[count]\x1b[0m Processes files on [count] worker threads. A count of 0 uses one thread per logical processor.\n"
+			"\x1b[1m/link      \x1b[0mWith /replace, creates hard links to target files which already start with the notice instead of copying them. Output files created this way share their contents with the target files: editing one edits the target file as well. Later runs delete such an output file before writing it, so the target file is never written through it.\n"
+			"\x1b[1m/log       \x1b[34m[order]\x1b[0m Once done, lists each target file with its outcome, size and time: sorted by path, or in no particular order if [order] is \"unsorted\". Otherwise, only the totals are printed.\n"
+			"\x1b[1m/maxmem    \x1b[34m[MiB]\x1b[0m Limits the memory used for queued target files and file data to [MiB]. Buffers are reused between files, and no new file is started while they are all in use. Target files are not mapped into memory.\n"
+			"\x1b[1m/note      \x1b[34m[str]\x1b[0m Specifies the notice to write into the output files. \"{file}\", \"{root}\" and \"{year}\" are replaced with the name of each target file, the name of its /dir root and the current year.\n"
+			"\x1b[1m/notef     \x1b[34m[name]\x1b[0m Specifies the name of a text file which contains the notice to write into the output files, as with /note.\n"
+			"\x1b[1m/overwrite \x1b[34m[policy]\x1b[0m What to do with output files which already exist: \"always\" overwrites them, \"never\" keeps them and \"newer\" overwrites them if the target file is newer. By default, you are asked once before any file is processed.\n"
+			"\x1b[1m/progress  \x1b[0mShows the number of files processed and the rates of progress on a status line while running.\n"
+			"\x1b[1m/recurse   \x1b[0mSearches through subdirectories.\n"
+			"\x1b[1m/resume    \x1b[34m[name]\x1b[0m Records each finished target file in the journal [name] as the run goes. If a run is interrupted, running it again with the same arguments skips the files it finished. The journal is deleted once a run completes.\n"
+			"\x1b[1m/verbose   \x1b[0mLogs extended information.\n"
+			"\x1b[1m/watch     \x1b[0mAfter processing the target directories, keeps running and stamps target files again whenever they are added or changed, until stopped with Ctrl+C.\n"
+			"\x1b[1m/stats     \x1b[34m[name]\x1b[0m Prints the time spent in each phase, bytes and calls counted, and the slowest files once done. If [name] is given, the counters are also written to it as JSON.\n"
+			"\x1b[1m/syntax    \x1b[34m[syntax] \x1b[0mSets the comment syntax of the notice: a line comment prefix, or the opening and closing tokens of a block comment separated by a space, such as \"/* */\". Directly after /ext, applies to that extension only; otherwise, sets the default, which is \"// \".\n"
+			"\x1b[1m/syntaxf   \x1b[34m[name]\x1b[0m Adds the target file extensions and comment syntaxes listed in a text file, one \"ext=syntax\" per line.\n"
+			"\x1b[1m/replace   \x1b[0mIf a comment is already present at the beginning of a source file, it is replaced.\n"
+			"\x1b[90mArguments \x1b[0m/note\x1b[90m and \x1b[0m/notef\x1b[90m are mutually exclusive.\n"
+			"\x1b[90mArguments \x1b[0m/async\x1b[90m and \x1b[0m/jobs\x1b[90m are mutually exclusive, as are \x1b[0m/async\x1b[90m and \x1b[0m/inplace\x1b[90m.\n"
+			"\n\x1b[1mExample:\x1b[0m copynotice /dir \"program\\code\" \"temp\" /note \"Written by John Doe.\" /ext \"h\" /ext \"c\" /verbose\n\n"
+		);
+		return false;
+	}
+	bool given[std::size(argument_options) + 1] = {}; // indexed by argument_name_id.
+	std::size_t lastArgumentExtension = SIZE_MAX; // the extension added by the previous argument, if it was /ext.
+	for (int argIdx = 1; argIdx < ArgC; ++argIdx)
+	{
+		wchar_t* arg = ArgV[argIdx];
+		if (arg[0] != L'/')
+		{
+			mCons.write(L"\x1b[1;31mError: Expected argument name, got \"").write(arg).write(L"\". Argument names must start with a forward slash.\n");
+			return false;
+		}
+		// A /syntax which directly follows an /ext applies to that extension.
+		auto const previousArgumentExtension = std::exchange(lastArgumentExtension, SIZE_MAX);
+		std::wstring_view const argName(arg + 1);
+		auto const id = find_argument_name_id(argName);
+		if (id == argument_name_id::unknown)
+		{
+			mCons.write(L"\x1b[1;31mError: Unknown argument \"").write(argName).write(L"\"\n");
+			return false;
+		}
+
+		auto const& option = argument_options[static_cast<std::size_t>(id) - 1];
+		if (!option.repeatable && std::exchange(given[static_cast<std::size_t>(id)], true))
+		{
+			mCons.write({ L"\x1b[1;31mError: /", argName, L" already set.\n" });
+			return false;
+		}
+		wchar_t const* subargument = nullptr;
+		if (option.subargument == subargument_kind::required || option.subargument == subargument_kind::verbatim)
+		{
+			if (++argIdx == ArgC || (option.subargument == subargument_kind::required && ArgV[argIdx][0] == L'/'))
+			{
+				mCons.write({ L"\x1b[1;31mError: Argument \"", argName, L"\" must be followed by a subargument.\n" });
+				return false;
+			}
+			subargument = ArgV[argIdx];
+		}
+		else if (option.subargument == subargument_kind::optional && argIdx + 1 != ArgC && ArgV[argIdx + 1][0] != L'/')
+		{
+			subargument = ArgV[++argIdx];
+		}
+
+		switch (id)
+		{
+		case find_argument_name_id(L"async"):
+			if (!parse_uint(subargument, 4096, mAsync) || mAsync == 0)
+			{
+				mCons.write(L"\x1b[1;31mError: Argument \"async\": subargument must be a number from 1 to 4096.\n");
+				return false;
+			}
+			break;
+
+		case find_argument_name_id(L"bench"):
+			mBench = true;
+			if (subargument && !parse_bench_spec(subargument))
+			{
+				return false;
+			}
+			break;
+
+		case find_argument_name_id(L"check"):
+			mCheck = true;
+			break;
+
+		case find_argument_name_id(L"dir"):
+			if (++argIdx == ArgC || ArgV[argIdx][0] == L'/')
+			{
+				mCons.write(L"\x1b[1;31mError: Argument \"dir\": expected 2 subarguments, got 0.\n");
+				return false;
+			}
+			{
+				// The paths are checked by open_roots, which checks the roots of a copynotice::batch too.
+				auto& dir = mDirectories.emplace_back();
+				dir.src = ArgV[argIdx];
+				if (argIdx + 1 == ArgC || ArgV[argIdx + 1][0] == L'/')
+				{
+					// No output directory; only valid with /inplace, which is checked once every argument is read.
+					break;
+				}
+				dir.dst = ArgV[++argIdx];
+				if (dir.dst.empty())
+				{
+					mCons.write(L"\x1b[1;31mError: Argument \"dir\": subargument 2 (dst): argument cannot be empty.\n");
+					return false;
+				}
+			}
+			break;
+
+		case find_argument_name_id(L"ext"):
+			if (!add_extension(subargument))
+			{
+				return false;
+			}
+			lastArgumentExtension = mExtensions.size() - 1;
+			break;
+
+		case find_argument_name_id(L"files"):
+			mFileListPath = subargument;
+			break;
+
+		case find_argument_name_id(L"incremental"):
+			mIncremental = true;
+			break;
+
+		case find_argument_name_id(L"inplace"):
+			mInPlace = true;
+			break;
+
+		case find_argument_name_id(L"jobs"):
+			if (!parse_uint(subargument, 256, mJobs))
+			{
+				mCons.write(L"\x1b[1;31mError: Argument \"jobs\": subargument must be a number from 0 to 256.\n");
+				return false;
+			}
+			if (mJobs == 0)
+			{
+				mJobs = std::max(std::thread::hardware_concurrency(), 1u);
+			}
+			break;
+
+		case find_argument_name_id(L"link"):
+			mLinkStamped = true;
+			break;
+
+		case find_argument_name_id(L"log"):
+			if (std::wstring_view const order = subargument ? subargument : L"sorted"; order == L"sorted")
+			{
+				mLogOrder = log_order::sorted;
+			}
+			else if (order == L"unsorted")
+			{
+				mLogOrder = log_order::unsorted;
+			}
+			else
+			{
+				mCons.write(L"\x1b[1;31mError: Argument \"log\": subargument must be \"sorted\" or \"unsorted\".\n");
+				return false;
+			}
+			break;
+
+		case find_argument_name_id(L"maxmem"):
+			{
+				std::uint32_t mebibytes;
+				if (!parse_uint(subargument, 1024 * 1024, mebibytes) || mebibytes == 0)
+				{
+					mCons.write(L"\x1b[1;31mError: Argument \"maxmem\": subargument must be a number of MiB from 1 to 1048576.\n");
+					return false;
+				}
+				mMaxMemory = std::uint64_t{ mebibytes } * 1024 * 1024;
+			}
+			break;
+
+		case find_argument_name_id(L"note"):
+			if (!mNotice.empty())
+			{
+				mCons.write(L"\x1b[1;31mError: Notice string already supplied.\n");
+				return false;
+			}
+			mNotice = wdul::utf16_to_utf8(subargument);
+			break;
+
+		case find_argument_name_id(L"notef"):
+			if (!mNotice.empty())
+			{
+				mCons.write(L"\x1b[1;31mError: Notice string already supplied.\n");
+				return false;
+			}
+			{
+				auto f = wdul::fopen(subargument, wdul::file_open_mode::open_existing, FILE_FLAG_SEQUENTIAL_SCAN, wdul::generic_access::read, wdul::file_share_mode::read);
+				auto const size = wdul::fgetsize(f.get());
+				mNotice.resize(static_cast<std::uint32_t>(size));
+				wdul::check_bool(ReadFile(f.get(), &mNotice[0], static_cast<std::uint32_t>(size), nullptr, nullptr));
+			}
+			break;
+
+		case find_argument_name_id(L"overwrite"):
+			if (std::wstring_view const policy = subargument; policy == L"always")
+			{
+				mOverwrite = overwrite_policy::always;
+			}
+			else if (policy == L"never")
+			{
+				mOverwrite = overwrite_policy::never;
+			}
+			else if (policy == L"newer")
+			{
+				mOverwrite = overwrite_policy::newer;
+			}
+			else
+			{
+				mCons.write(L"\x1b[1;31mError: Argument \"overwrite\": subargument must be \"always\", \"never\" or \"newer\".\n");
+				return false;
+			}
+			break;
+
+		case find_argument_name_id(L"progress"):
+			mShowProgress = true;
+			break;
+
+		case find_argument_name_id(L"recurse"):
+			mRecurse = true;
+			break;
+
+		case find_argument_name_id(L"verbose"):
+			mVerbose = true;
+			mCons.write(L"\x1b[90m");
+			echo_command_line(mCons, ArgC, ArgV);
+			break;
+
+		case find_argument_name_id(L"watch"):
+			mWatch = true;
+			break;
+
+		case find_argument_name_id(L"syntax"):
+			if (previousArgumentExtension == SIZE_MAX)
+			{
+				if (!parse_syntax(subargument, mSyntaxes.front()))
+				{
+					return false;
+				}
+				break;
+			}
+			if (!parse_syntax(subargument, mSyntaxes.emplace_back()))
+			{
+				return false;
+			}
+			mExtensionSyntaxes[previousArgumentExtension] = mSyntaxes.size() - 1;
+			break;
+
+		case find_argument_name_id(L"syntaxf"):
+			if (!read_syntax_file(subargument))
+			{
+				return false;
+			}
+			break;
+
+		case find_argument_name_id(L"stats"):
+			mStats = true;
+			if (subargument)
+			{
+				mStatsPath = subargument;
+			}
+			break;
+
+		case find_argument_name_id(L"replace"):
+			mReplace = true;
+			break;
+
+		case find_argument_name_id(L"resume"):
+			mResumePath = subargument;
+			break;
+
+		default:
+			mCons.write(L"\x1b[1;31mError: Behaviour not implemented for argument \"").write(argName).write(L"\"\n");
+			return false;
+		}
+	}
+
+	return finish_options() && open_roots();
+}
+
+[[nodiscard]] bool program::instance::configure(copynotice::batch_config const& Config)
+{
+	if (Config.jobs > 256 || Config.async > 4096)
+	{
+		mCons.write(L"\x1b[1;31mError: At most 256 jobs and 4096 async files are allowed.\n");
+		return false;
+	}
+	mNotice = wdul::utf16_to_utf8(Config.notice);
+	if (!parse_syntax(Config.syntax, mSyntaxes.front()))
+	{
+		return false;
+	}
+	for (auto const& extension : Config.extensions)
+	{
+		if (!add_extension(extension.name))
+		{
+			return false;
+		}
+		if (!extension.syntax.empty())
+		{
+			if (!parse_syntax(extension.syntax, mSyntaxes.emplace_back()))
+			{
+				return false;
+			}
+			mExtensionSyntaxes.back() = mSyntaxes.size() - 1;
+		}
+	}
+	mOverwrite = Config.overwrite;
+	mRecurse = Config.recurse;
+	mReplace = Config.replace;
+	mInPlace = Config.inPlace;
+	mCheck = Config.check;
+	mIncremental = Config.incremental;
+	mLinkStamped = Config.link;
+	mVerbose = Config.verbose;
+	mStats = Config.stats;
+	mJobs = Config.jobs;
+	mAsync = Config.async;
+	mMaxMemory = Config.maxMemory;
+	return finish_options();
+}
+
+[[nodiscard]] bool program::instance::finish_options()
+{
+	if (mAsync != 0 && mJobs != 0)
+	{
+		mCons.write(L"\x1b[1;31mError: Arguments /async and /jobs are mutually exclusive.\n");
+		return false;
+	}
+	if (mAsync != 0 && mInPlace)
+	{
+		mCons.write(L"\x1b[1;31mError: Arguments /async and /inplace are mutually exclusive.\n");
+		return false;
+	}
+	if (mCheck)
+	{
+		if (mInPlace || mAsync != 0 || mBench || mWatch || mIncremental)
+		{
+			mCons.write(L"\x1b[1;31mError: Argument /check cannot be used with /inplace, /async, /bench, /watch or /incremental.\n");
+			return false;
+		}
+		// Target files are read where they are, as with /inplace, and no output directory is involved.
+		mInPlace = true;
+	}
+	if (mBench)
+	{
+		if (!mDirectories.empty() || mInPlace || mIncremental)
+		{
+			mCons.write(L"\x1b[1;31mError: Argument /bench cannot be used with /dir, /inplace or /incremental.\n");
+			return false;
+		}
+		// The benchmark works without a notice or extension, so that "copynotice /bench" is enough to run it.
+		if (mNotice.empty()) mNotice = u8"Copyright (c) copynotice benchmark. All rights reserved.";
+		if (mExtensions.empty() && !add_extension(L"cpp")) return false;
+		if (mBenchRoot.empty())
+		{
+			wchar_t tempPath[MAX_PATH + 1];
+			auto const tempPathLen = GetTempPathW(static_cast<DWORD>(std::size(tempPath)), tempPath);
+			if (tempPathLen == 0 || tempPathLen > std::size(tempPath))
+			{
+				wdul::throw_last_error("Could not get the temporary directory");
+			}
+			mBenchRoot.assign(tempPath, tempPathLen);
+			mBenchRoot += L"copynotice-bench-";
+			mBenchRoot += std::to_wstring(GetCurrentProcessId());
+		}
+		mRecurse = true;
+	}
+
+	if (!mResumePath.empty() && (mBench || mWatch || mCheck))
+	{
+		mCons.write(L"\x1b[1;31mError: Argument /resume cannot be used with /bench, /watch or /check.\n");
+		return false;
+	}
+	if (mWatch && (mBench || !mFileListPath.empty() || mDirectories.empty()))
+	{
+		mCons.write(L"\x1b[1;31mError: Argument /watch requires /dir, and cannot be used with /bench or /files.\n");
+		return false;
+	}
+	mCreateOutputDirectories = !mFileListPath.empty() && !mInPlace;
+	if (!mFileListPath.empty())
+	{
+		if (mBench || mDirectories.size() > 1)
+		{
+			mCons.write(L"\x1b[1;31mError: Argument /files cannot be used with /bench or with more than one /dir.\n");
+			return false;
+		}
+		if (mFileListPath == L"-" && !mInPlace && mOverwrite != overwrite_policy::always)
+		{
+			mCons.write(L"\x1b[1;31mError: Reading /files from standard input requires /overwrite always, since existing output files can't be looked up before the list is read.\n");
+			return false;
+		}
+	}
+
+	mExtensionSet.assign(mExtensions, mExtensionSyntaxes);
+
+	// The year is the same in every file, so it is part of the rendered header, and of the notice hash: the next
+	// /incremental run in a new year stamps every file again.
+	SYSTEMTIME now;
+	GetLocalTime(&now);
+	auto const year = std::to_string(now.wYear);
+	for (std::size_t at; (at = mNotice.find(u8"{year}")) != mNotice.npos;)
+	{
+		mNotice.replace(at, 6, reinterpret_cast<char8_t const*>(year.data()), year.size());
+	}
+
+	// Render the header of every comment syntax once, so that one pass over the tree stamps every language.
+	for (auto& syntax : mSyntaxes)
+	{
+		syntax.render(mNotice, mReplace);
+		for (std::size_t format = 0; format != static_cast<std::size_t>(text_format::count); ++format)
+		{
+			mHeaderRoom = std::max(mHeaderRoom, syntax.header_room(static_cast<text_format>(format)));
+		}
+	}
+
+	if (mMaxMemory != 0)
+	{
+		// Every file in flight holds one pooled buffer, which is as large as a copy buffer. Mapped views and unbuffered
+		// copies would use memory outside the pool, so bodies are copied through the pooled buffers instead.
+		auto const bufferSize = mHeaderRoom + copy_buffer_size;
+		auto const poolBudget = mMaxMemory - mMaxMemory / maxmem_queue_share;
+		if (poolBudget < bufferSize)
+		{
+			mCons.write(L"\x1b[1;31mError: Argument \"maxmem\": the budget must hold at least one copy buffer of ").write(std::to_wstring(bufferSize / 1024 + 1)).write(L" KiB, after the share of the queue.\n");
+			return false;
+		}
+		mPool.emplace(bufferSize, poolBudget);
+		mUseMapping = false;
+	}
+
+	return true;
+}
+
+[[nodiscard]] bool program::instance::open_roots()
+{
+	mRootDirectories = mDirectories.size();
+	for (auto const& directories : mDirectories)
+	{
+		if (!check_directory_path(directories.src, L"1 (src)") || !check_directory_path(directories.dst, L"2 (dst)"))
+		{
+			return false;
+		}
+		if (!mInPlace && directories.dst.empty())
+		{
+			mCons.write(L"\x1b[1;31mError: Argument \"dir\": expected 2 subarguments, got 1.\n");
+			return false;
+		}
+		if (mInPlace && !directories.dst.empty())
+		{
+			mCons.write({ L"\x1b[1;31mError: Argument \"dir\": subargument 2 (dst) cannot be used with ", mCheck ? L"/check" : L"/inplace", L".\n" });
+			return false;
+		}
+	}
+
+	for (auto& directories : mDirectories)
+	{
+		// Every path below a /dir argument is built from its extended-length form, so depth is no longer limited by
+		// MAX_PATH and each path is passed to the file system as it is.
+		directories.src = mRootPaths.store({ extended_length_path(directories.src) });
+		if (!mInPlace) directories.dst = mRootPaths.store({ extended_length_path(directories.dst) });
+		directories.rootLength = directories.src.size();
+		if (mInPlace)
+		{
+			// The manifest of an in-place target is kept in the target directory itself.
+			if (mIncremental) directories.manifest = &mManifests.emplace_back(directories.src);
+			directories.cloneClusterSize = block_clone_cluster_size(directories.src, directories.src);
+			continue;
+		}
+		if (!CreateDirectoryW(directories.dst.data(), nullptr))
+		{
+			auto const lastError = GetLastError();
+			if (lastError != ERROR_ALREADY_EXISTS)
+			{
+				wdul::throw_win32(lastError, "Could not create output directory. Ensure intermediate directories exist");
+			}
+		}
+		else
+		{
+			mCons.write(L"\x1b[90mCreated output directory \x1b[33m\"").write(directories.dst).write(L"\"\x1b[0m\n");
+		}
+		if (mIncremental)
+		{
+			directories.manifest = &mManifests.emplace_back(directories.dst);
+		}
+		directories.cloneClusterSize = block_clone_cluster_size(directories.src, directories.dst);
+	}
+
+	return true;
+}
+
+[[nodiscard]] bool program::instance::check_directory_path(std::wstring_view const Path, std::wstring_view const Subargument)
+{
+	if (Path.ends_with(L"\\") || Path.ends_with(L"/"))
+	{
+		mCons.write({ L"\x1b[1;31mError: Argument \"dir\": subargument ", Subargument, L": do not use a trailing slash.\n" });
+		return false;
+	}
+	if (Path.find_first_of(L"<>:\"|?*") != Path.npos)
+	{
+		mCons.write({ L"\x1b[1;31mError: Argument \"dir\": subargument \"", Path, L"\" contains an illegal character.\n" });
+		return false;
+	}
+	return true;
+}
+
+[[nodiscard]] bool program::instance::run_batch(std::span<copynotice::batch_root const> const Roots, copynotice::batch_callbacks const& Callbacks, overwrite_policy const Overwrite,
+	copynotice::batch_result& Result)
+{
+	// Every run starts from its own roots, as every run of the benchmark does. The policy is reset, since scan_outputs
+	// replaces overwrite_policy::ask with the answer of the previous run.
+	mDirectories.clear();
+	mDirectoryPaths.clear();
+	mRootPaths.clear();
+	mManifests.clear();
+	mOverwrite = Overwrite;
+	for (auto const& root : Roots)
+	{
+		mDirectories.push_back({ root.src, root.dst });
+	}
+	if (!open_roots())
+	{
+		return false;
+	}
+
+	auto const start = std::chrono::steady_clock::now();
+	mCallbacks = &Callbacks;
+	try
+	{
+		Result.totals = execute();
+	}
+	catch (...)
+	{
+		mCallbacks = nullptr;
+		throw;
+	}
+	mCallbacks = nullptr;
+	Result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (mStats)
+	{
+		Result.counters = { mRunStats.files, mRunStats.bytesRead, mRunStats.bytesWritten, mRunStats.bytesCloned, mRunStats.findCalls, mRunStats.openCalls,
+			mRunStats.readCalls, mRunStats.writeCalls, mRunStats.cloneCalls };
+	}
+	return true;
+}
+
+template <class FileFn, class DirectoryFn>
+void program::instance::walk(std::uint32_t const Walkers, FileFn&& OnFile, DirectoryFn&& OnDirectoryEnd)
+{
+	// A directory is never targeted twice, even if it is also a subdirectory of another target directory, or spelled
+	// with different case.
+	std::unordered_set<std::wstring_view, path_hash, path_equal> targeted;
+	for (auto const& directories : mDirectories)
+	{
+		targeted.insert(directories.src);
+	}
+	std::mutex directoriesMutex; // guards mDirectories, mDirectoryPaths and targeted while several threads walk.
+
+	// Appends a subdirectory to mDirectories and creates its output directory, before it is enumerated. Returns its index, or SIZE_MAX
+	// if it is already targeted. Path is the full source path, in a buffer owned by the calling thread.
+	auto const addSubdirectory = [&](directory_argument const& Parent, std::wstring_view const Path, std::wstring_view const Name) -> std::size_t
+	{
+		std::unique_lock lock(directoriesMutex);
+		if (targeted.contains(Path))
+		{
+			lock.unlock();
+			mCons.write({ L"\x1b[90mDirectory \x1b[33m\"", Path, L"\"\x1b[90m is already targeted.\n" });
+			return SIZE_MAX;
+		}
+		directory_argument newDirectory;
+		newDirectory.src = mDirectoryPaths.store({ Path });
+		newDirectory.rootLength = Parent.rootLength;
+		newDirectory.manifest = Parent.manifest;
+		newDirectory.cloneClusterSize = Parent.cloneClusterSize;
+		if (!mInPlace)
+		{
+			newDirectory.dst = mDirectoryPaths.store({ Parent.dst, L"\\", Name });
+		}
+		targeted.insert(newDirectory.src);
+		auto const index = mDirectories.size();
+		auto const& added = mDirectories.emplace_back(newDirectory);
+		lock.unlock();
+
+		if (!mInPlace)
+		{
+			// Create the output directory before any of its files are processed.
+			if (CreateDirectoryW(added.dst.data(), nullptr))
+			{
+				mCons.write({ L"\x1b[90mCreated output directory \x1b[33m\"", added.dst, L"\"\x1b[0m\n" });
+			}
+			else if (auto const lastError = GetLastError(); lastError != ERROR_ALREADY_EXISTS)
+			{
+				wdul::throw_win32(lastError, "Could not create output directory");
+			}
+		}
+		return index;
+	};
+
+	if (Walkers <= 1)
+	{
+		// Subdirectories are appended to mDirectories while it is being walked.
+		walk_state state;
+		for (std::size_t directoryIdx = 0; directoryIdx < mDirectories.size(); ++directoryIdx)
+		{
+			auto const& directories = mDirectories[directoryIdx];
+			auto const targetFileCount = enumerate_directory(directories, state, OnFile, [&](std::wstring_view const Path, std::wstring_view const Name)
+			{
+				addSubdirectory(directories, Path, Name);
+			});
+			if (!targetFileCount)
+			{
+				break;
+			}
+			OnDirectoryEnd(directories, *targetFileCount);
+		}
+		collect_stats(state.stats);
+		return;
+	}
+
+	// Each walker keeps a stack of directories to enumerate, for locality within its branch of the tree. An idle
+	// walker steals the oldest directory of another walker, which is the root of the largest unexplored branch.
+	struct walker_stack
+	{
+		std::mutex mutex;
+		std::deque<std::size_t> directories;
+	};
+	std::vector<walker_stack> stacks(Walkers);
+	for (std::size_t directoryIdx = 0; directoryIdx < mDirectories.size(); ++directoryIdx)
+	{
+		stacks[directoryIdx % Walkers].directories.push_back(directoryIdx);
+	}
+
+	// The number of directories pushed but not yet enumerated. The walk is over once it reaches zero.
+	std::size_t outstanding = mDirectories.size();
+	std::atomic<std::uint64_t> pushes = 0; // only changed while idleMutex is held, so that idle walkers can't miss a push.
+	std::mutex idleMutex;
+	std::condition_variable idleCondition;
+	std::atomic<bool> stop = false;
+	std::exception_ptr error;
+
+	auto const take = [&](std::size_t const Self, std::size_t& DirectoryIdx)
+	{
+		for (std::size_t i = 0; i < Walkers; ++i)
+		{
+			auto& stack = stacks[(Self + i) % Walkers];
+			std::scoped_lock const lock(stack.mutex);
+			if (!stack.directories.empty())
+			{
+				if (i == 0)
+				{
+					DirectoryIdx = stack.directories.back();
+					stack.directories.pop_back();
+				}
+				else
+				{
+					DirectoryIdx = stack.directories.front();
+					stack.directories.pop_front();
+				}
+				return true;
+			}
+		}
+		return false;
+	};
+
+	auto const walker = [&](std::size_t const Self)
+	{
+		walk_state state;
+		try
+		{
+			while (!stop)
+			{
+				std::size_t directoryIdx;
+				auto const seenPushes = pushes.load();
+				if (!take(Self, directoryIdx))
+				{
+					std::unique_lock lock(idleMutex);
+					idleCondition.wait(lock, [&] { return outstanding == 0 || stop || pushes != seenPushes; });
+					if (outstanding == 0 || stop)
+					{
+						break;
+					}
+					continue;
+				}
+
+				std::unique_lock directoriesLock(directoriesMutex);
+				auto const& directories = mDirectories[directoryIdx];
+				directoriesLock.unlock();
+				auto const targetFileCount = enumerate_directory(directories, state, OnFile, [&](std::wstring_view const Path, std::wstring_view const Name)
+				{
+					auto const index = addSubdirectory(directories, Path, Name);
+					if (index == SIZE_MAX)
+					{
+						return;
+					}
+					{
+						std::scoped_lock const lock(idleMutex);
+						++outstanding;
+					}
+					{
+						std::scoped_lock const lock(stacks[Self].mutex);
+						stacks[Self].directories.push_back(index);
+					}
+					{
+						std::scoped_lock const lock(idleMutex);
+						++pushes;
+					}
+					idleCondition.notify_one();
+				});
+				if (targetFileCount)
+				{
+					OnDirectoryEnd(directories, *targetFileCount);
+				}
+
+				bool done;
+				{
+					std::scoped_lock const lock(idleMutex);
+					if (!targetFileCount) stop = true;
+					done = --outstanding == 0 || stop;
+				}
+				if (done) idleCondition.notify_all();
+			}
+		}
+		catch (...)
+		{
+			std::scoped_lock const lock(idleMutex);
+			if (!error) error = std::current_exception();
+			stop = true;
+		}
+		idleCondition.notify_all();
+		collect_stats(state.stats);
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(Walkers - 1);
+	try
+	{
+		for (std::uint32_t i = 1; i < Walkers; ++i)
+		{
+			threads.emplace_back(walker, i);
+		}
+	}
+	catch (...)
+	{
+		{
+			std::scoped_lock const lock(idleMutex);
+			stop = true;
+		}
+		idleCondition.notify_all();
+		for (auto& thread : threads) thread.join();
+		throw;
+	}
+	walker(0);
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+template <class FileFn, class SubdirectoryFn>
+std::optional<std::uint32_t> program::instance::enumerate_directory(directory_argument const& Directories, walk_state& State, FileFn& OnFile, SubdirectoryFn&& OnSubdirectory)
+{
+	auto& findData = State.findData;
+	auto& searchString = State.path;
+	auto& walkStats = State.stats;
+	auto* const stats = mStats ? &walkStats : nullptr;
+
+	// Walkers print these lines in no particular order, so they are only printed with /verbose, keeping the default
+	// output to the totals.
+	if (mVerbose && mInPlace)
+	{
+		mCons.write({ L"\x1b[90mTarget directory: \x1b[33m\"", Directories.src, mCheck ? L"\"\x1b[90m (check only)\x1b[0m\n" : L"\"\x1b[90m (in place)\x1b[0m\n" });
+	}
+	else if (mVerbose)
+	{
+		mCons.write({ L"\x1b[90mTarget directory: \x1b[33m\"", Directories.src,
+			L"\"\x1b[90m. Output directory: \x1b[33m\"", Directories.dst, L"\"\x1b[0m\n" });
+	}
+
+	// Find every file and subdirectory in a single pass.
+	searchString = Directories.src;
+	searchString += Directories.src.empty() ? L"*" : L"\\*";
+	auto const findFirst = [&]
+	{
+		phase_timer const timer(stats, stats_phase::enumerate);
+		++walkStats.findCalls;
+		return FindFirstFileExW(searchString.data(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+	};
+	wdul::find_file_handle findHandle(findFirst());
+	auto const findNext = [&]
+	{
+		phase_timer const timer(stats, stats_phase::enumerate);
+		++walkStats.findCalls;
+		return FindNextFileW(findHandle.get(), &findData);
+	};
+	if (!findHandle)
+	{
+		// FindFirstFile shouldn't fail with ERROR_NO_MORE_FILES because of the current and parent directories ("." and "..").
+		wdul::throw_last_error("FindFirstFile failed");
+	}
+
+	// The search string is reused to build the paths of subdirectories.
+	searchString.resize(searchString.size() - 1);
+	auto const prefixLength = searchString.size();
+
+	std::uint32_t targetFileCount = 0;
+	do
+	{
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN)
+		{
+			// Skip hidden files and directories.
+			continue;
+		}
+
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			if (!mRecurse)
+			{
+				continue;
+			}
+			if (findData.cFileName[0] == L'.' && (findData.cFileName[1] == L'\0' || (findData.cFileName[1] == L'.' && findData.cFileName[2] == L'\0')))
+			{
+				// Skip the current & parent directories.
+				continue;
+			}
+			searchString.resize(prefixLength);
+			searchString += findData.cFileName;
+			OnSubdirectory(std::wstring_view(searchString), std::wstring_view(findData.cFileName));
+			continue;
+		}
+
+		if (!mExtensionSet.matches(findData.cFileName))
+		{
+			continue;
+		}
+		++targetFileCount;
+		if (!OnFile(Directories, findData))
+		{
+			return std::nullopt;
+		}
+	} while (findNext());
+
+	auto const errorCode = GetLastError();
+	if (errorCode != ERROR_NO_MORE_FILES)
+	{
+		wdul::throw_win32(errorCode, "FindNextFile failed");
+	}
+
+	if (targetFileCount == 0 && mVerbose)
+	{
+		mCons.write({ L"\x1b[32mCould not find a target file in directory: \x1b[33m\"", Directories.src, L"\"\n" });
+	}
+	return targetFileCount;
+}
+
+template <class FileFn, class DirectoryFn>
+void program::instance::find_targets(std::uint32_t const Walkers, FileFn&& OnFile, DirectoryFn&& OnDirectoryEnd)
+{
+	if (mFileListPath.empty())
+	{
+		walk(Walkers, [&](directory_argument const& Directories, WIN32_FIND_DATAW const& FindData)
+		{
+			return OnFile(Directories, std::wstring_view(FindData.cFileName), std::wstring_view(), file_attributes::from(FindData));
+		}, OnDirectoryEnd);
+		return;
+	}
+
+	// The list replaces enumeration, so each listed file is queried on its own, which is far cheaper than searching
+	// every directory it could be in.
+	read_file_list([&](directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, std::wstring const& SrcPath)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExW(SrcPath.data(), GetFileExInfoStandard, &attributes) || (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			mCons.write({ L"\x1b[1;31mListed target file ", SrcPath, L" does not exist.\x1b[0m\n" });
+			return true;
+		}
+		return OnFile(Directories, Fname, DstFname, file_attributes{ (std::uint64_t{ attributes.nFileSizeHigh } << 32) | attributes.nFileSizeLow, to_uint64(attributes.ftLastWriteTime) });
+	});
+}
+
+template <class EntryFn>
+void program::instance::read_file_list(EntryFn&& OnEntry)
+{
+	unique_handle listFile;
+	HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+	if (mFileListPath != L"-")
+	{
+		listFile.reset(CreateFileW(mFileListPath.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+		if (!listFile)
+		{
+			wdul::throw_last_error("Could not open the list of files");
+		}
+		input = listFile.get();
+	}
+
+	// Each line is "src>dst", or a path relative to the source directory of the /dir argument, if there is one. In
+	// place, each line is just the path of a target file.
+	auto const root = mDirectories.empty() ? nullptr : &mDirectories.front();
+	// "." and ".." aren't resolved in extended-length paths, so lines relative to the root are joined to its Win32 form
+	// and normalised, as the roots are.
+	std::wstring const rootSrc = root ? win32_path(root->src) : std::wstring();
+	std::wstring const rootDst = root ? win32_path(root->dst) : std::wstring();
+	line_reader reader(input);
+	std::u8string_view utf8;
+	std::wstring line;
+	std::wstring srcPath;
+	std::wstring listedSrc; // the extended-length paths of a file named by path.
+	std::wstring listedDst;
+	for (std::size_t lineNumber = 1; reader.next(utf8); ++lineNumber)
+	{
+		if (lineNumber == 1 && utf8.starts_with(byte_order_marks[0])) utf8.remove_prefix(byte_order_marks[0].size());
+		if (utf8.empty())
+		{
+			continue;
+		}
+		line.resize(utf8.size());
+		auto const length = MultiByteToWideChar(CP_UTF8, 0, reinterpret_cast<char const*>(utf8.data()), static_cast<int>(utf8.size()), line.data(), static_cast<int>(line.size()));
+		if (length <= 0)
+		{
+			wdul::throw_last_error("Could not convert a line of the list of files");
+		}
+		line.resize(static_cast<std::size_t>(length));
+		// Paths below a /dir argument are extended-length paths, in which forward slashes aren't separators.
+		std::replace(line.begin(), line.end(), L'/', L'\\');
+
+		std::wstring_view fname = line;
+		std::wstring_view dstFname;
+		auto const* directories = root ? root : &mListedFiles;
+		if (auto const separator = line.find(L'>'); separator != line.npos)
+		{
+			// /check only reads the target file of a pair.
+			if (mInPlace && !mCheck)
+			{
+				mCons.write({ L"\x1b[1;31mError: Argument \"files\": line ", std::to_wstring(lineNumber), L" names an output file, which /inplace doesn't write.\x1b[0m\n" });
+				continue;
+			}
+			fname = fname.substr(0, separator);
+			dstFname = std::wstring_view(line).substr(separator + 1);
+			directories = &mListedFiles;
+		}
+		else if (!root && !mInPlace)
+		{
+			mCons.write({ L"\x1b[1;31mError: Argument \"files\": line ", std::to_wstring(lineNumber), L" has no \"src>dst\" pair, and there is no /dir argument to mirror it into.\x1b[0m\n" });
+			continue;
+		}
+		if (directories == root)
+		{
+			listedSrc = extended_length_path(rootSrc + L'\\' + std::wstring(fname));
+			if (listedSrc.size() > root->src.size() && listedSrc.starts_with(root->src) && listedSrc[root->src.size()] == L'\\')
+			{
+				fname = std::wstring_view(listedSrc).substr(root->src.size() + 1);
+			}
+			else
+			{
+				// The line leads out of the root with "..", so the file is named by its path, and its output file is
+				// the same path relative to the destination root.
+				if (!mInPlace)
+				{
+					listedDst = extended_length_path(rootDst + L'\\' + std::wstring(fname));
+					dstFname = listedDst;
+				}
+				fname = listedSrc;
+				directories = &mListedFiles;
+			}
+		}
+		else if (directories == &mListedFiles)
+		{
+			// Files named by path aren't below a /dir argument, so their own paths are made extended-length, as the
+			// roots are, and aren't limited to MAX_PATH either.
+			listedSrc = extended_length_path(fname);
+			fname = listedSrc;
+			if (!dstFname.empty())
+			{
+				listedDst = extended_length_path(dstFname);
+				dstFname = listedDst;
+			}
+		}
+
+		srcPath = directories->src;
+		if (!srcPath.empty()) srcPath += L'\\';
+		srcPath += fname;
+		if (!OnEntry(*directories, fname, dstFname, srcPath))
+		{
+			return;
+		}
+	}
+}
+
+void program::instance::create_output_directory(target_paths& Paths)
+{
+	auto const parentLength = Paths.dst.find_last_of(L"\\/");
+	if (parentLength == Paths.dst.npos || parentLength == 0 || std::wstring_view(Paths.dst).substr(0, parentLength) == Paths.createdDirectory)
+	{
+		return;
+	}
+	auto& directory = Paths.createdDirectory;
+	directory.assign(Paths.dst, 0, parentLength);
+	if (CreateDirectoryW(directory.data(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		return;
+	}
+
+	// Create the missing ancestors from the top down. Ancestors which exist, drive roots and shares fail harmlessly.
+	for (auto separator = directory.find_first_of(L"\\/", 1); separator != directory.npos; separator = directory.find_first_of(L"\\/", separator + 1))
+	{
+		auto const ch = std::exchange(directory[separator], L'\0');
+		CreateDirectoryW(directory.data(), nullptr);
+		directory[separator] = ch;
+	}
+	if (!CreateDirectoryW(directory.data(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		auto const lastError = GetLastError();
+		directory.clear();
+		wdul::throw_win32(lastError, "Could not create an output directory");
+	}
+}
+
+[[nodiscard]] bool program::instance::add_extension(std::wstring_view const Extension)
+{
+	if (Extension.size() > 15)
+	{
+		mCons.write(L"\x1b[1;31mError: Argument \"ext\": extension too long.\n");
+		return false;
+	}
+	if (Extension.empty())
+	{
+		mCons.write(L"\x1b[1;31mError: Argument \"ext\": extension cannot be blank.\n");
+		return false;
+	}
+	if (Extension.find_first_of(L"<>:\"/\\|?*.") != Extension.npos)
+	{
+		mCons.write(L"\x1b[1;31mError: Extension \"").write(Extension).write(L"\" contains an illegal character.\n");
+		return false;
+	}
+	mExtensions.emplace_back(Extension);
+	mExtensionSyntaxes.push_back(0);
+	return true;
+}
+
+[[nodiscard]] bool program::instance::parse_syntax(std::wstring_view const Subargument, comment_syntax& Syntax)
+{
+	auto const syntax = wdul::utf16_to_utf8(Subargument);
+	if (syntax.find_first_not_of(u8' ') == syntax.npos)
+	{
+		mCons.write(L"\x1b[1;31mError: Argument \"syntax\": subargument must not be blank.\n");
+		return false;
+	}
+	if (syntax.find_first_of(u8"\r\n") != syntax.npos)
+	{
+		mCons.write(L"\x1b[1;31mError: Argument \"syntax\": subargument must not contain a line break.\n");
+		return false;
+	}
+
+	// A space followed by more text separates the tokens of a block comment. Trailing spaces belong to a line prefix.
+	auto const openEnd = syntax.find(u8' ');
+	auto const closeStart = syntax.find_first_not_of(u8' ', openEnd);
+	if (openEnd == 0 || closeStart == syntax.npos)
+	{
+		Syntax.prefix = syntax;
+		Syntax.close.clear();
+		return true;
+	}
+	auto const closeEnd = syntax.find_last_not_of(u8' ') + 1;
+	Syntax.prefix = syntax.substr(0, openEnd);
+	Syntax.close = syntax.substr(closeStart, closeEnd - closeStart);
+	if (Syntax.close.find(u8' ') != Syntax.close.npos)
+	{
+		mCons.write(L"\x1b[1;31mError: Argument \"syntax\": a block comment syntax must be exactly two tokens, such as \"/* */\".\n");
+		return false;
+	}
+	return true;
+}
+
+[[nodiscard]] bool program::instance::read_syntax_file(wchar_t const* const Fname)
+{
+	std::u8string contents;
+	{
+		auto f = wdul::fopen(Fname, wdul::file_open_mode::open_existing, FILE_FLAG_SEQUENTIAL_SCAN, wdul::generic_access::read, wdul::file_share_mode::read);
+		auto const size = wdul::fgetsize(f.get());
+		contents.resize(static_cast<std::uint32_t>(size));
+		wdul::check_bool(ReadFile(f.get(), contents.data(), static_cast<std::uint32_t>(size), nullptr, nullptr));
+	}
+
+	// Lines are "ext=syntax". Blank lines and lines starting with ';' are ignored.
+	for (std::size_t lineStart = 0, lineNumber = 1; lineStart < contents.size(); ++lineNumber)
+	{
+		auto lineEnd = contents.find(u8'\n', lineStart);
+		if (lineEnd == contents.npos) lineEnd = contents.size();
+		auto line = std::u8string_view(contents).substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd + 1;
+		if (line.ends_with(u8'\r')) line.remove_suffix(1);
+		if (line.empty() || line.front() == u8';')
+		{
+			continue;
+		}
+
+		auto const equals = line.find(u8'=');
+		if (equals == line.npos)
+		{
+			mCons.write({ L"\x1b[1;31mError: Argument \"syntaxf\": line ", std::to_wstring(lineNumber), L" is not of the form \"ext=syntax\".\n" });
+			return false;
+		}
+		if (!add_extension(wdul::utf8_to_utf16(line.substr(0, equals))) ||
+			!parse_syntax(wdul::utf8_to_utf16(line.substr(equals + 1)), mSyntaxes.emplace_back()))
+		{
+			return false;
+		}
+		mExtensionSyntaxes.back() = mSyntaxes.size() - 1;
+	}
+	return true;
+}
+
+[[nodiscard]] bool program::instance::parse_bench_spec(std::wstring_view Spec)
+{
+	while (!Spec.empty())
+	{
+		auto const pairEnd = std::min(Spec.find(L','), Spec.size());
+		auto const pair = Spec.substr(0, pairEnd);
+		Spec.remove_prefix(std::min(pairEnd + 1, Spec.size()));
+
+		auto const equals = pair.find(L'=');
+		if (equals == pair.npos)
+		{
+			mCons.write({ L"\x1b[1;31mError: Argument \"bench\": expected key=value, got \"", pair, L"\".\n" });
+			return false;
+		}
+		auto const key = pair.substr(0, equals);
+		auto const value = pair.substr(equals + 1);
+		auto& spec = mBenchSpec;
+		bool valid = true;
+		if (key == L"files") valid = parse_uint(value, 10'000'000, spec.files) && spec.files != 0;
+		else if (key == L"depth") valid = parse_uint(value, 8, spec.depth);
+		else if (key == L"fanout") valid = parse_uint(value, 64, spec.fanout) && spec.fanout != 0;
+		else if (key == L"stamped") valid = parse_uint(value, 100, spec.stampedPercent);
+		else if (key == L"runs") valid = parse_uint(value, 1000, spec.runs) && spec.runs != 0;
+		else if (key == L"size")
+		{
+			// Either a single size or a min-max range, in bytes.
+			auto const dash = value.find(L'-');
+			valid = parse_uint(value.substr(0, dash), 1u << 30, spec.minSize) &&
+				parse_uint(dash == value.npos ? value : value.substr(dash + 1), 1u << 30, spec.maxSize) &&
+				spec.minSize != 0 && spec.minSize <= spec.maxSize;
+		}
+		else if (key == L"dir")
+		{
+			mBenchRoot = value;
+			valid = !value.empty() && !value.ends_with(L'\\') && !value.ends_with(L'/');
+		}
+		else if (key == L"engines")
+		{
+			// Engine names separated by '+', e.g. "mapped+async".
+			mBenchEngines = value;
+		}
+		else if (key == L"keep")
+		{
+			valid = value == L"0" || value == L"1";
+			mBenchKeep = value == L"1";
+		}
+		else
+		{
+			mCons.write({ L"\x1b[1;31mError: Argument \"bench\": unknown key \"", key, L"\".\n" });
+			return false;
+		}
+		if (!valid)
+		{
+			mCons.write({ L"\x1b[1;31mError: Argument \"bench\": invalid value for \"", key, L"\".\n" });
+			return false;
+		}
+	}
+	return true;
+}
+
+void program::instance::run_benchmark()
+{
+	// Generate the synthetic tree. The random number generator is seeded with a constant so that every run of the
+	// benchmark measures the same tree.
+	auto const& spec = mBenchSpec;
+	std::mt19937_64 random(0x636F70796E6F7469);
+	std::wstring const srcRoot = mBenchRoot + L"\\src";
+	std::wstring const dstRoot = mBenchRoot + L"\\dst";
+	mCons.write({ L"\x1b[90mGenerating benchmark tree in \x1b[33m\"", mBenchRoot, L"\"\x1b[90m...\x1b[0m\n" });
+	for (auto const& root : { mBenchRoot, srcRoot, dstRoot })
+	{
+		if (!CreateDirectoryW(root.data(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+		{
+			wdul::throw_last_error("Could not create the benchmark directory");
+		}
+	}
+
+	// Every level of the tree has Fanout times as many directories as the level above it.
+	std::vector<std::wstring> directories{ L"" };
+	for (std::size_t levelStart = 0, level = 0; level < spec.depth; ++level)
+	{
+		auto const levelEnd = directories.size();
+		for (auto parent = levelStart; parent < levelEnd; ++parent)
+		{
+			for (std::uint32_t child = 0; child < spec.fanout; ++child)
+			{
+				auto name = directories[parent];
+				if (!name.empty()) name += L'\\';
+				name += L'd';
+				name += std::to_wstring(child);
+				directories.push_back(std::move(name));
+				auto const path = srcRoot + L'\\' + directories.back();
+				if (!CreateDirectoryW(path.data(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+				{
+					wdul::throw_last_error("Could not create a benchmark directory");
+				}
+			}
+		}
+		levelStart = levelEnd;
+	}
+
+	// File contents are taken from a block of plausible source code. File sizes are log-uniformly distributed, so that
+	// most files are small and a few are large, as in a real source tree.
+	std::u8string code;
+	for (std::uint32_t i = 0; code.size() < 64 * 1024; ++i)
+	{
+		auto const n = std::to_string(i);
+		code += u8"int function_";
+		code.append(n.begin(), n.end());
+		code += u8"(int value)\r\n{\r\n\treturn value * 3 + 1;\r\n}\r\n\r\n";
+	}
+	std::uniform_real_distribution<double> logSize(std::log(static_cast<double>(spec.minSize)), std::log(static_cast<double>(spec.maxSize)));
+	std::uniform_int_distribution<std::uint32_t> percent(0, 99);
+	std::uint64_t totalBytes = 0;
+	std::u8string headerBuffer;
+	for (std::uint32_t i = 0; i < spec.files; ++i)
+	{
+		auto path = srcRoot;
+		auto const& directory = directories[i % directories.size()];
+		if (!directory.empty()) path += L'\\';
+		path += directory;
+		path += L"\\file";
+		path += std::to_wstring(i);
+		path += L'.';
+		path += mExtensions.front();
+
+		auto file = wdul::fopen(path.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_NORMAL, wdul::generic_access::write, wdul::file_share_mode::read);
+		auto size = static_cast<std::uint64_t>(std::exp(logSize(random)));
+		if (percent(random) < spec.stampedPercent)
+		{
+			auto const header = mSyntaxes[mExtensionSyntaxes.front()].header(text_format::utf8_crlf, file_name(path), file_name(srcRoot), headerBuffer);
+			write_all(file.get(), header.size(), reinterpret_cast<std::uint8_t const*>(header.data()));
+			size -= std::min<std::uint64_t>(size, header.size());
+		}
+		totalBytes += size;
+		while (size != 0)
+		{
+			auto const chunk = std::min<std::uint64_t>(size, code.size());
+			write_all(file.get(), chunk, reinterpret_cast<std::uint8_t const*>(code.data()));
+			size -= chunk;
+		}
+		file.close();
+	}
+	mCons.write(L"\x1b[90mGenerated ").write(std::to_wstring(spec.files)).write(L" file(s) in ").write(std::to_wstring(directories.size()))
+		.write(L" directories, ").write(std::to_wstring(totalBytes / 1024)).write(L" KiB.\x1b[0m\n\n");
+
+	struct engine
+	{
+		std::wstring_view name;
+		std::uint32_t jobs;
+		std::uint32_t async;
+		bool mapping;
+		bool presize;
+		bool naive = false;
+	};
+	engine const engines[] =
+	{
+		// The copy loop copynotice started with, for a baseline: 64-byte reads and writes, appended to the output file.
+		{ L"naive", 0, 0, false, false, true },
+		{ L"mapped", 0, 0, true, true },
+		{ L"appended", 0, 0, true, false }, // mapped, with output files grown by each write instead of sized up front.
+		{ L"buffered", 0, 0, false, true },
+		{ L"jobs", std::max(std::thread::hardware_concurrency(), 1u), 0, true, true },
+		{ L"async", 0, 64, true, true },
+	};
+
+	mCons.write(L"\x1b[1;4mEngine    Run     Files   Time (ms)     Files/s      MiB/s   I/O calls   p50 (us)   p99 (us)\x1b[0m\n");
+	mOverwrite = overwrite_policy::always;
+	mRecordLatency = true;
+	for (auto const& e : engines)
+	{
+		if (!mBenchEngines.empty() && mBenchEngines.find(e.name) == mBenchEngines.npos)
+		{
+			continue;
+		}
+		mJobs = e.jobs;
+		mAsync = e.async;
+		mUseMapping = e.mapping && !mPool;
+		mPresize = e.presize;
+		mNaive = e.naive;
+		for (std::uint32_t run = 0; run < spec.runs; ++run)
+		{
+			mDirectories.clear();
+			mDirectoryPaths.clear();
+			mDirectories.push_back({ srcRoot, dstRoot, srcRoot.size() });
+			mLatencies.clear();
+
+			IO_COUNTERS ioBefore, ioAfter;
+			wdul::check_bool(GetProcessIoCounters(GetCurrentProcess(), &ioBefore));
+			auto const start = std::chrono::steady_clock::now();
+			mCons.mute(true);
+			try
+			{
+				execute();
+			}
+			catch (...)
+			{
+				mCons.mute(false);
+				throw;
+			}
+			mCons.mute(false);
+			auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			wdul::check_bool(GetProcessIoCounters(GetCurrentProcess(), &ioAfter));
+
+			std::sort(mLatencies.begin(), mLatencies.end());
+			auto const percentile = [&](std::size_t const P) -> std::uint32_t
+			{
+				return mLatencies.empty() ? 0 : mLatencies[(mLatencies.size() - 1) * P / 100];
+			};
+			auto const ioCalls = (ioAfter.ReadOperationCount - ioBefore.ReadOperationCount) +
+				(ioAfter.WriteOperationCount - ioBefore.WriteOperationCount) +
+				(ioAfter.OtherOperationCount - ioBefore.OtherOperationCount);
+
+			wchar_t line[160];
+			std::swprintf(line, std::size(line), L"%-8.*ls %4u %9zu %11.1f %11.0f %10.1f %11llu %10u %10u\n",
+				static_cast<int>(e.name.size()), e.name.data(), run + 1, mLatencies.size(), elapsed * 1000.0,
+				static_cast<double>(mLatencies.size()) / elapsed, static_cast<double>(totalBytes) / (1024.0 * 1024.0) / elapsed,
+				static_cast<unsigned long long>(ioCalls), percentile(50), percentile(99));
+			mCons.write(line);
+		}
+	}
+	mRecordLatency = false;
+	mNaive = false;
+
+	if (!mBenchKeep)
+	{
+		remove_tree(mBenchRoot);
+	}
+}
+
+void program::instance::remove_tree(std::wstring const& Path)
+{
+	WIN32_FIND_DATAW findData;
+	auto const searchString = Path + L"\\*";
+	wdul::find_file_handle findHandle(FindFirstFileExW(searchString.data(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH));
+	if (findHandle)
+	{
+		do
+		{
+			if (findData.cFileName[0] == L'.' && (findData.cFileName[1] == L'\0' || (findData.cFileName[1] == L'.' && findData.cFileName[2] == L'\0')))
+			{
+				continue;
+			}
+			auto const childPath = Path + L'\\' + findData.cFileName;
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				remove_tree(childPath);
+			}
+			else
+			{
+				DeleteFileW(childPath.data());
+			}
+		} while (FindNextFileW(findHandle.get(), &findData));
+	}
+	RemoveDirectoryW(Path.data());
+}
+
+void program::instance::collect_measurements(worker_context& Context)
+{
+	if (mRecordLatency)
+	{
+		std::scoped_lock const lock(mMeasurementMutex);
+		mLatencies.insert(mLatencies.end(), Context.latencies.begin(), Context.latencies.end());
+		Context.latencies.clear();
+	}
+	if (!Context.log.records.empty())
+	{
+		std::scoped_lock const lock(mMeasurementMutex);
+		mLogs.push_back(std::move(Context.log));
+		Context.log = {};
+	}
+	collect_stats(Context.stats);
+}
+
+void program::instance::collect_stats(run_stats& Stats)
+{
+	if (mStats)
+	{
+		std::scoped_lock const lock(mMeasurementMutex);
+		mRunStats += Stats;
+	}
+	Stats = {};
+}
+
+program::file_status program::instance::process_file(directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes, worker_context& Context)
+{
+	// The clock is only read if the time is recorded.
+	auto const measured = measures_files();
+	std::chrono::steady_clock::time_point start;
+	if (measured) start = std::chrono::steady_clock::now();
+	auto const status = create_file(Directories, Fname, DstFname, Attributes, Context);
+	if (mPool) Context.copyBuffer.reset();
+	mProgress.add_file(Attributes.size);
+	journal_file(Context.paths.src, status);
+	if (measured) record_file(Context, std::chrono::steady_clock::now() - start, Directories, Fname, Context.paths.src, status, Attributes.size);
+	return status;
+}
+
+program::run_totals program::instance::execute()
+{
+	run_totals totals;
+	mRunStats = {};
+	auto const start = std::chrono::steady_clock::now();
+	mCons.write(L"\x1b[0m");
+	if (!mResumePath.empty())
+	{
+		open_journal();
+	}
+	if (mOverwrite != overwrite_policy::always && !mInPlace)
+	{
+		scan_outputs();
+	}
+	mProgress.start(mCons, mShowProgress);
+	if (mJobs != 0)
+	{
+		totals = execute_parallel();
+	}
+	else if (mAsync != 0)
+	{
+		totals = execute_async();
+	}
+	else
+	{
+		worker_context context;
+		run_totals directoryTotals;
+		find_targets(1, [&](directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes)
+		{
+			directoryTotals.add(process_file(Directories, Fname, DstFname, Attributes, context));
+			return true;
+		}, [&](directory_argument const& Directories, std::uint32_t const TargetFileCount)
+		{
+			if (TargetFileCount != 0 && mCheck)
+			{
+				mCons.write({ L"\x1b[32;1mFinished directory \"", Directories.src, L"\": ", std::to_wstring(directoryTotals.missing + directoryTotals.stale), L" file(s) need stamping\x1b[0m\n" });
+			}
+			else if (TargetFileCount != 0)
+			{
+				mCons.write(L"\x1b[32;1mFinished directory \"").write(Directories.src).write(mInPlace ? L"\": Rewrote " : L"\": Created ").write(std::to_wstring(directoryTotals.created)).write(L" file(s)\x1b[0m\n");
+			}
+			totals += directoryTotals;
+			directoryTotals = {};
+		});
+		// Files from a /files list don't belong to any directory which is finished.
+		totals += directoryTotals;
+		collect_measurements(context);
+	}
+
+	mProgress.stop();
+	print_log();
+	for (auto const& manifest : mManifests)
+	{
+		manifest.save();
+	}
+	if (mJournal)
+	{
+		// Every target file has been finished, so there is nothing left to resume.
+		mJournal->finish();
+		mJournal.reset();
+	}
+
+	if (mCheck)
+	{
+		mCons.write({ totals.missing + totals.stale != 0 ? L"\x1b[33;1mDone. " : L"\x1b[32;1mDone. ", std::to_wstring(totals.missing), L" file(s) missing the notice, ",
+			std::to_wstring(totals.stale), L" with a stale notice, ", std::to_wstring(totals.upToDate), L" up to date" });
+	}
+	else
+	{
+		mCons.write(mInPlace ? L"\x1b[32;1mDone. Rewrote " : L"\x1b[32;1mDone. Created ").write(std::to_wstring(totals.created)).write(L" file(s)");
+	}
+	if (!mCheck && (mIncremental || mInPlace || totals.upToDate != 0))
+	{
+		mCons.write(L", ").write(std::to_wstring(totals.upToDate)).write(L" file(s) up to date");
+	}
+	if (totals.declined != 0)
+	{
+		mCons.write(L", kept ").write(std::to_wstring(totals.declined)).write(L" existing file(s)");
+	}
+	if (totals.resumed != 0)
+	{
+		mCons.write(L", skipped ").write(std::to_wstring(totals.resumed)).write(L" file(s) finished by the interrupted run");
+	}
+	mCons.write(L"\x1b[0m\n");
+
+	if (mStats)
+	{
+		report_stats(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	mCons.flush();
+	return totals;
+}
+
+void program::instance::open_journal()
+{
+	auto runHash = fnv1a_basis;
+	for (auto const& syntax : mSyntaxes)
+	{
+		runHash = fnv1a(runHash, std::as_bytes(std::span(&syntax.noticeHash, 1)));
+	}
+	runHash = fnv1a(runHash, std::as_bytes(std::span(&mInPlace, 1)));
+	// Each string is hashed with its length, so that the boundaries between strings are part of the hash too.
+	auto const hashString = [&](std::wstring_view const String)
+	{
+		auto const length = static_cast<std::uint64_t>(String.size());
+		runHash = fnv1a(runHash, std::as_bytes(std::span(&length, 1)));
+		runHash = fnv1a(runHash, std::as_bytes(std::span(String)));
+	};
+	for (std::size_t i = 0; i < mRootDirectories; ++i)
+	{
+		hashString(mDirectories[i].src);
+		hashString(mDirectories[i].dst);
+	}
+	hashString(mFileListPath);
+	for (auto const& extension : mExtensions)
+	{
+		hashString(extension);
+	}
+	mJournal.emplace(mResumePath, runHash);
+	if (auto const previous = mJournal->previous_count(); previous != 0)
+	{
+		mCons.write({ L"\x1b[94mResuming: the interrupted run finished ", std::to_wstring(previous), L" file(s), which are skipped.\x1b[0m\n" });
+	}
+}
+
+void program::instance::watch()
+{
+	// A target directory watched with ReadDirectoryChangesW. At most one read of its changes is in flight at a time.
+	struct watched_root
+	{
+		directory_argument const* directories = nullptr;
+		unique_handle handle;
+		OVERLAPPED overlapped;
+		std::unique_ptr<DWORD[]> changes = std::make_unique_for_overwrite<DWORD[]>(watch_buffer_size / sizeof(DWORD)); // DWORD-aligned, as ReadDirectoryChangesW requires.
+		std::unordered_set<std::wstring, path_hash, path_equal> changed; // target files changed since the last batch, relative to the root.
+	};
+
+	unique_handle const port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1));
+	if (!port)
+	{
+		wdul::throw_last_error("Could not create an I/O completion port");
+	}
+
+	std::vector<watched_root> roots(mRootDirectories);
+	auto const listen = [&](watched_root& Root)
+	{
+		Root.overlapped = {};
+		if (!ReadDirectoryChangesW(Root.handle.get(), Root.changes.get(), watch_buffer_size, mRecurse,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE, nullptr, &Root.overlapped, nullptr))
+		{
+			wdul::throw_last_error("Could not watch a target directory");
+		}
+	};
+	for (std::size_t i = 0; i < roots.size(); ++i)
+	{
+		auto& root = roots[i];
+		root.directories = &mDirectories[i];
+		root.handle.reset(CreateFileW(root.directories->src.empty() ? L"." : root.directories->src.data(), FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr));
+		if (!root.handle)
+		{
+			wdul::throw_last_error("Could not open a target directory to watch it");
+		}
+		if (!CreateIoCompletionPort(root.handle.get(), port.get(), i, 0))
+		{
+			wdul::throw_last_error("Could not associate a target directory with an I/O completion port");
+		}
+		listen(root);
+	}
+	mCons.write(L"\x1b[94mWatching for changes to target files. Press Ctrl+C to stop.\x1b[0m\n");
+	mCons.flush();
+
+	// Changed files can be in directories which have no output directory yet. The context, and with it the copy buffer
+	// and paths, is kept from batch to batch.
+	mCreateOutputDirectories = !mInPlace;
+	worker_context context;
+	std::wstring srcPath;
+	bool pending = false;
+	bool lostChanges = false;
+	for (;;)
+	{
+		DWORD transferred;
+		ULONG_PTR key;
+		OVERLAPPED* overlapped;
+		BOOL const succeeded = GetQueuedCompletionStatus(port.get(), &transferred, &key, &overlapped, pending ? watch_debounce_milliseconds : INFINITE);
+		if (overlapped)
+		{
+			auto& root = roots[key];
+			if (!succeeded)
+			{
+				wdul::throw_last_error("Could not watch a target directory");
+			}
+			if (transferred == 0)
+			{
+				// More changes were made than fit in the buffer, so which files changed is unknown.
+				lostChanges = true;
+			}
+			for (auto const* info = reinterpret_cast<FILE_NOTIFY_INFORMATION const*>(root.changes.get()); transferred != 0;
+				info = reinterpret_cast<FILE_NOTIFY_INFORMATION const*>(reinterpret_cast<std::uint8_t const*>(info) + info->NextEntryOffset))
+			{
+				std::wstring_view const name(info->FileName, info->FileNameLength / sizeof(wchar_t));
+				if ((info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_RENAMED_NEW_NAME) &&
+					mExtensionSet.matches(name))
+				{
+					root.changed.emplace(name);
+				}
+				if (info->NextEntryOffset == 0) break;
+			}
+			listen(root);
+			pending = true;
+			continue;
+		}
+		if (GetLastError() != WAIT_TIMEOUT)
+		{
+			wdul::throw_last_error("GetQueuedCompletionStatus failed");
+		}
+
+		// No change has been reported for the debounce interval, so the files which changed are likely complete.
+		pending = false;
+		if (std::exchange(lostChanges, false))
+		{
+			mCons.write(L"\x1b[93mToo many changes to follow; searching the target directories again.\x1b[0m\n");
+			for (auto& root : roots)
+			{
+				root.changed.clear();
+			}
+			mDirectories.resize(mRootDirectories);
+			mDirectoryPaths.clear();
+			execute();
+			continue;
+		}
+
+		run_totals totals;
+		for (auto& root : roots)
+		{
+			for (auto const& name : root.changed)
+			{
+				srcPath = root.directories->src;
+				if (!srcPath.empty()) srcPath += L'\\';
+				srcPath += name;
+				WIN32_FILE_ATTRIBUTE_DATA attributes;
+				if (!GetFileAttributesExW(srcPath.data(), GetFileExInfoStandard, &attributes) || (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				{
+					// The file was removed or renamed again before the batch started.
+					continue;
+				}
+				totals.add(process_file(*root.directories, name, {}, file_attributes{ (std::uint64_t{ attributes.nFileSizeHigh } << 32) | attributes.nFileSizeLow, to_uint64(attributes.ftLastWriteTime) }, context));
+			}
+			root.changed.clear();
+		}
+		collect_measurements(context);
+		print_log();
+		for (auto const& manifest : mManifests)
+		{
+			manifest.save();
+		}
+		if (totals.created != 0)
+		{
+			mCons.write({ L"\x1b[32;1m", mInPlace ? L"Rewrote " : L"Created ", std::to_wstring(totals.created), L" changed file(s)\x1b[0m\n" });
+		}
+		mCons.flush();
+	}
+}
+
+void program::instance::print_log()
+{
+	// Every thread's records are gathered first, so that workers never wait on the console to keep the order.
+	std::vector<std::pair<file_log const*, file_record const*>> entries;
+	std::size_t count = 0;
+	for (auto const& log : mLogs)
+	{
+		count += log.records.size();
+	}
+	entries.reserve(count);
+	for (auto const& log : mLogs)
+	{
+		for (auto const& record : log.records)
+		{
+			entries.emplace_back(&log, &record);
+		}
+	}
+	if (entries.empty())
+	{
+		mLogs.clear();
+		return;
+	}
+	if (mLogOrder == log_order::sorted)
+	{
+		std::sort(entries.begin(), entries.end(), [](auto const& A, auto const& B) { return A.first->path(*A.second) < B.first->path(*B.second); });
+	}
+
+	static constexpr std::wstring_view status_names[] = { L"created", L"declined", L"up to date", L"missing", L"stale", L"resumed" };
+	wchar_t line[64];
+	mCons.write(L"\n\x1b[1;4mStatus              Bytes       Time  Path\x1b[0m\n");
+	for (auto const& [log, record] : entries)
+	{
+		auto const status = status_names[static_cast<std::size_t>(record->status)];
+		std::swprintf(line, std::size(line), L"%-10.*ls %14llu %7.1f ms  ", static_cast<int>(status.size()), status.data(),
+			static_cast<unsigned long long>(record->bytes), static_cast<double>(record->microseconds) / 1000.0);
+		mCons.write({ line, log->path(*record), L"\n" });
+	}
+	mCons.write(L"\n");
+	mLogs.clear();
+}
+
+void program::instance::scan_outputs()
+{
+	mExistingOutputs.clear();
+	if (!mFileListPath.empty())
+	{
+		// Only the listed output files can be overwritten, so only they are looked up.
+		target_paths paths;
+		// A listed file which doesn't exist is never processed, so its output file isn't asked about.
+		read_file_list([&](directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, std::wstring const& SrcPath)
+		{
+			build_paths(Directories, Fname, DstFname, paths);
+			WIN32_FILE_ATTRIBUTE_DATA srcAttributes;
+			WIN32_FILE_ATTRIBUTE_DATA dstAttributes;
+			if (GetFileAttributesExW(paths.dst.data(), GetFileExInfoStandard, &dstAttributes) &&
+				GetFileAttributesExW(SrcPath.data(), GetFileExInfoStandard, &srcAttributes) && !(srcAttributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				mExistingOutputs.emplace(paths.dst, to_uint64(dstAttributes.ftLastWriteTime));
+			}
+			return true;
+		});
+	}
+	WIN32_FIND_DATAW findData;
+	std::wstring path;
+	std::vector<std::wstring> pending;
+	for (auto const& directories : mDirectories)
+	{
+		if (mFileListPath.empty()) pending.emplace_back(directories.dst);
+	}
+	while (!pending.empty())
+	{
+		auto const directory = std::move(pending.back());
+		pending.pop_back();
+		path = directory;
+		path += L"\\*";
+		wdul::find_file_handle findHandle(FindFirstFileExW(path.data(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH));
+		if (!findHandle)
+		{
+			// A destination directory which doesn't exist yet has no output files.
+			continue;
+		}
+		do
+		{
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if (mRecurse && !(findData.cFileName[0] == L'.' && (findData.cFileName[1] == L'\0' || (findData.cFileName[1] == L'.' && findData.cFileName[2] == L'\0'))))
+				{
+					pending.push_back(directory + L'\\' + findData.cFileName);
+				}
+				continue;
+			}
+			if (mExtensionSet.matches(findData.cFileName))
+			{
+				path = directory;
+				path += L'\\';
+				path += findData.cFileName;
+				mExistingOutputs.emplace(std::move(path), to_uint64(findData.ftLastWriteTime));
+			}
+		} while (FindNextFileW(findHandle.get(), &findData));
+	}
+
+	if (mOverwrite != overwrite_policy::ask || mExistingOutputs.empty())
+	{
+		return;
+	}
+	// Output files which no target file maps to, such as those of deleted or hidden target files, aren't overwritten,
+	// so they aren't asked about. The listed output files are only those of listed target files which exist.
+	std::vector<std::wstring_view> conflicts;
+	if (mFileListPath.empty())
+	{
+		conflicts = find_conflicts();
+	}
+	else
+	{
+		for (auto const& existing : mExistingOutputs)
+		{
+			conflicts.push_back(existing.first);
+		}
+	}
+	if (conflicts.empty())
+	{
+		// Nothing would be overwritten, so there is nothing to ask.
+		return;
+	}
+	mCons.write({ L"\x1b[94m", std::to_wstring(conflicts.size()), L" output file(s) already exist.\x1b[0m\n" });
+	if (mVerbose)
+	{
+		for (auto const existing : conflicts)
+		{
+			mCons.write({ L" \x1b[93m\"", existing, L"\"\x1b[0m\n" });
+		}
+	}
+	if (mCallbacks)
+	{
+		// A batch can't read from the console, so it keeps the existing output files unless its callback says otherwise.
+		mOverwrite = mCallbacks->confirmOverwrite && mCallbacks->confirmOverwrite(conflicts.size()) ? overwrite_policy::always : overwrite_policy::never;
+		return;
+	}
+	mCons.write(L"Do you want to overwrite them? (y/n)\n");
+	mOverwrite = ask_yesno(mCons) ? overwrite_policy::always : overwrite_policy::never;
+}
+
+std::vector<std::wstring_view> program::instance::find_conflicts() const
+{
+	// Walks the source roots as enumerate_directory does, pairing each source directory with its output directory.
+	// A directory which is also a subdirectory of another root maps its files to the same output files twice, so each
+	// conflict is only counted once.
+	std::vector<std::wstring_view> conflicts;
+	std::unordered_set<std::wstring_view, path_hash, path_equal> found;
+	WIN32_FIND_DATAW findData;
+	std::wstring path;
+	std::vector<std::pair<std::wstring, std::wstring>> pending;
+	for (auto const& directories : mDirectories)
+	{
+		pending.emplace_back(directories.src, directories.dst);
+	}
+	while (!pending.empty())
+	{
+		auto const [src, dst] = std::move(pending.back());
+		pending.pop_back();
+		path = src;
+		path += src.empty() ? L"*" : L"\\*";
+		wdul::find_file_handle findHandle(FindFirstFileExW(path.data(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH));
+		if (!findHandle)
+		{
+			// The walk reports the directory when it gets to it.
+			continue;
+		}
+		do
+		{
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN)
+			{
+				continue;
+			}
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			{
+				if (mRecurse && !(findData.cFileName[0] == L'.' && (findData.cFileName[1] == L'\0' || (findData.cFileName[1] == L'.' && findData.cFileName[2] == L'\0'))))
+				{
+					pending.emplace_back(src.empty() ? std::wstring(findData.cFileName) : src + L'\\' + findData.cFileName, dst + L'\\' + findData.cFileName);
+				}
+				continue;
+			}
+			if (mExtensionSet.matches(findData.cFileName))
+			{
+				path = dst;
+				path += L'\\';
+				path += findData.cFileName;
+				if (auto const existing = mExistingOutputs.find(path); existing != mExistingOutputs.end() && found.insert(existing->first).second)
+				{
+					conflicts.push_back(existing->first);
+				}
+			}
+		} while (FindNextFileW(findHandle.get(), &findData));
+	}
+	return conflicts;
+}
+
+void program::instance::report_stats(double const WallSeconds)
+{
+	auto const& stats = mRunStats;
+	auto const milliseconds = [](std::uint64_t const Nanoseconds) { return static_cast<double>(Nanoseconds) / 1'000'000.0; };
+
+	// Phase times are summed over every thread, so with /jobs they can add up to more than the wall time. With /async,
+	// they exclude the time spent waiting for I/O to complete.
+	wchar_t line[160];
+	mCons.write(L"\n\x1b[1;4mPhase             Time (ms)\x1b[0m\n");
+	for (std::size_t i = 0; i < std::size(stats.phaseNanoseconds); ++i)
+	{
+		std::swprintf(line, std::size(line), L"%-14.*ls %12.1f\n", static_cast<int>(stats_phase_names[i].size()), stats_phase_names[i].data(), milliseconds(stats.phaseNanoseconds[i]));
+		mCons.write(line);
+	}
+	std::swprintf(line, std::size(line), L"%-14ls %12.1f\n\n", L"wall", WallSeconds * 1000.0);
+	mCons.write(line);
+	std::swprintf(line, std::size(line), L"Files: %llu. Read %llu bytes, wrote %llu bytes, cloned %llu bytes.\n", static_cast<unsigned long long>(stats.files),
+		static_cast<unsigned long long>(stats.bytesRead), static_cast<unsigned long long>(stats.bytesWritten), static_cast<unsigned long long>(stats.bytesCloned));
+	mCons.write(line);
+	std::swprintf(line, std::size(line), L"Calls: %llu find, %llu open, %llu read, %llu write, %llu clone.\n", static_cast<unsigned long long>(stats.findCalls),
+		static_cast<unsigned long long>(stats.openCalls), static_cast<unsigned long long>(stats.readCalls), static_cast<unsigned long long>(stats.writeCalls),
+		static_cast<unsigned long long>(stats.cloneCalls));
+	mCons.write(line);
+	if (!stats.slowest.empty())
+	{
+		mCons.write(L"Slowest files:\n");
+		for (auto const& file : stats.slowest)
+		{
+			std::swprintf(line, std::size(line), L"%10.2f ms  ", milliseconds(file.nanoseconds));
+			mCons.write({ line, L"\x1b[33m\"", file.path, L"\"\x1b[0m\n" });
+		}
+	}
+
+	if (mStatsPath.empty())
+	{
+		return;
+	}
+
+	auto const appendNumber = [](std::u8string& Json, std::u8string_view const Key, auto const Value)
+	{
+		auto const digits = std::to_string(Value);
+		Json += u8'"';
+		Json += Key;
+		Json += u8"\":";
+		Json.append(digits.begin(), digits.end());
+	};
+	auto const appendString = [](std::u8string& Json, std::wstring_view const Value)
+	{
+		Json += u8'"';
+		for (auto const ch : wdul::utf16_to_utf8(Value))
+		{
+			if (ch == u8'"' || ch == u8'\\')
+			{
+				Json += u8'\\';
+				Json += ch;
+			}
+			else if (static_cast<unsigned char>(ch) < 0x20)
+			{
+				char escaped[7];
+				std::snprintf(escaped, std::size(escaped), "\\u%04x", static_cast<unsigned>(ch));
+				Json.append(escaped, escaped + 6);
+			}
+			else
+			{
+				Json += ch;
+			}
+		}
+		Json += u8'"';
+	};
+
+	std::u8string json = u8"{";
+	appendNumber(json, u8"wall_ns", static_cast<std::uint64_t>(WallSeconds * 1e9));
+	json += u8",\"phases_ns\":{";
+	for (std::size_t i = 0; i < std::size(stats.phaseNanoseconds); ++i)
+	{
+		if (i != 0) json += u8',';
+		auto const name = wdul::utf16_to_utf8(stats_phase_names[i]);
+		appendNumber(json, name, stats.phaseNanoseconds[i]);
+	}
+	json += u8"},";
+	appendNumber(json, u8"files", stats.files);
+	json += u8',';
+	appendNumber(json, u8"bytes_read", stats.bytesRead);
+	json += u8',';
+	appendNumber(json, u8"bytes_written", stats.bytesWritten);
+	json += u8',';
+	appendNumber(json, u8"bytes_cloned", stats.bytesCloned);
+	json += u8",\"calls\":{";
+	appendNumber(json, u8"find", stats.findCalls);
+	json += u8',';
+	appendNumber(json, u8"open", stats.openCalls);
+	json += u8',';
+	appendNumber(json, u8"read", stats.readCalls);
+	json += u8',';
+	appendNumber(json, u8"write", stats.writeCalls);
+	json += u8',';
+	appendNumber(json, u8"clone", stats.cloneCalls);
+	json += u8"},\"slowest\":[";
+	for (auto const& file : stats.slowest)
+	{
+		if (&file != &stats.slowest.front()) json += u8',';
+		json += u8"{\"path\":";
+		appendString(json, file.path);
+		json += u8',';
+		appendNumber(json, u8"ns", file.nanoseconds);
+		json += u8'}';
+	}
+	json += u8"]}\n";
+
+	auto file = wdul::fopen(mStatsPath.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_NORMAL, wdul::generic_access::write, wdul::file_share_mode::read);
+	write_all(file.get(), json.size(), reinterpret_cast<std::uint8_t const*>(json.data()));
+}
+
+program::run_totals program::instance::execute_parallel()
+{
+	bounded_queue<file_task> queue(std::size_t{ mJobs } * 64, queue_byte_capacity());
+
+	// The first exception thrown by any thread. Once set, the queue is cancelled so that every thread stops.
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	auto const fail = [&]
+	{
+		{
+			std::scoped_lock const lock(errorMutex);
+			if (!error) error = std::current_exception();
+		}
+		queue.cancel();
+	};
+
+	// Each worker counts its results in its own slot; the counts are merged once the workers finish.
+	std::vector<run_totals> workerTotals(mJobs);
+	std::vector<std::thread> workers;
+	workers.reserve(mJobs);
+	try
+	{
+		for (std::uint32_t i = 0; i < mJobs; ++i)
+		{
+			workers.emplace_back([this, &queue, &fail, &totals = workerTotals[i]]
+			{
+				try
+				{
+					worker_context context;
+					file_task task;
+					while (queue.pop(task))
+					{
+						totals.add(process_file(*task.directory, task.name, task.dstName, task.attributes, context));
+					}
+					collect_measurements(context);
+				}
+				catch (...)
+				{
+					fail();
+				}
+			});
+		}
+
+		// Produce target files on this thread and up to 7 others. Enumeration is mostly spent waiting on the file system,
+		// so walking several directories at once keeps the workers fed on slow volumes and network shares.
+		find_targets(std::min(mJobs, 8u), [&](directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes)
+		{
+			return push_task(queue, Directories, Fname, DstFname, Attributes);
+		}, [](directory_argument const&, std::uint32_t) {});
+	}
+	catch (...)
+	{
+		fail();
+	}
+
+	queue.close();
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+
+	run_totals total;
+	for (auto const& totals : workerTotals)
+	{
+		total += totals;
+	}
+	return total;
+}
+
+program::run_totals program::instance::execute_async()
+{
+	unique_handle const port(CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1));
+	if (!port)
+	{
+		wdul::throw_last_error("Could not create an I/O completion port");
+	}
+
+	bounded_queue<file_task> queue(std::size_t{ mAsync } * 4, queue_byte_capacity());
+
+	// Enumerate the target files on another thread, so that directory enumeration overlaps with file I/O.
+	std::exception_ptr producerError;
+	std::thread producer([&]
+	{
+		try
+		{
+			find_targets(async_walkers, [&](directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes)
+			{
+				return push_task(queue, Directories, Fname, DstFname, Attributes);
+			}, [](directory_argument const&, std::uint32_t) {});
+		}
+		catch (...)
+		{
+			producerError = std::current_exception();
+		}
+		queue.close();
+	});
+
+	std::vector<async_file> files(mAsync);
+	std::vector<async_file*> idle;
+	idle.reserve(files.size());
+	for (auto& file : files)
+	{
+		idle.push_back(&file);
+	}
+
+	run_totals totals;
+	worker_context context;
+	try
+	{
+		bool producing = true;
+		while (true)
+		{
+			// Start as many target files as there are idle slots. Block for the next target file only if there is
+			// nothing else to wait for.
+			while (producing && !idle.empty())
+			{
+				auto& file = *idle.back();
+				if (mPool && !file.buffer)
+				{
+					// Under /maxmem, a file is only started once a buffer is free. With no file in flight, no buffer is
+					// held, so waiting for one is safe.
+					file.buffer = idle.size() == files.size() ? mPool->acquire() : mPool->try_acquire();
+					if (!file.buffer) break;
+				}
+				auto result = bounded_queue<file_task>::pop_result::item;
+				if (idle.size() == files.size())
+				{
+					if (!queue.pop(file.task)) result = bounded_queue<file_task>::pop_result::closed;
+				}
+				else
+				{
+					result = queue.try_pop(file.task);
+				}
+				if (result == bounded_queue<file_task>::pop_result::empty)
+				{
+					break;
+				}
+				if (result == bounded_queue<file_task>::pop_result::closed)
+				{
+					producing = false;
+					break;
+				}
+				if (measures_files()) file.start = std::chrono::steady_clock::now();
+				if (start_async(file, port.get(), context, totals))
+				{
+					idle.pop_back();
+				}
+				else
+				{
+					record_finished(file, context);
+				}
+			}
+
+			if (idle.size() == files.size())
+			{
+				break;
+			}
+
+			DWORD transferred;
+			ULONG_PTR key;
+			OVERLAPPED* overlapped;
+			BOOL const succeeded = GetQueuedCompletionStatus(port.get(), &transferred, &key, &overlapped, INFINITE);
+			if (!overlapped)
+			{
+				wdul::throw_last_error("GetQueuedCompletionStatus failed");
+			}
+			auto& file = *reinterpret_cast<async_file*>(key);
+			file.pending = false;
+			if (!succeeded)
+			{
+				// A read at or past the end of a target file which shrank fails rather than reading 0 bytes.
+				if (!file.writing && GetLastError() == ERROR_HANDLE_EOF)
+				{
+					transferred = 0;
+				}
+				else
+				{
+						wdul::throw_last_error(file.writing ? "Failed to write to an output file" : "Failed to read from a target file");
+				}
+			}
+			if (!continue_async(file, transferred, context, totals))
+			{
+				record_finished(file, context);
+				if (mPool) file.buffer.reset();
+				idle.push_back(&file);
+			}
+		}
+	}
+	catch (...)
+	{
+		// Stop the producer, then wait for every operation in flight to finish before its buffers are freed.
+		queue.cancel();
+		for (auto& file : files)
+		{
+			if (file.pending)
+			{
+				CancelIoEx(file.src.get(), nullptr);
+				CancelIoEx(file.dst.get(), nullptr);
+			}
+		}
+		for (auto& file : files)
+		{
+			while (file.pending)
+			{
+				DWORD transferred;
+				ULONG_PTR key;
+				OVERLAPPED* overlapped;
+				GetQueuedCompletionStatus(port.get(), &transferred, &key, &overlapped, INFINITE);
+				if (overlapped) reinterpret_cast<async_file*>(key)->pending = false;
+			}
+		}
+		producer.join();
+		throw;
+	}
+
+	producer.join();
+	if (producerError)
+	{
+		std::rethrow_exception(producerError);
+	}
+	collect_measurements(context);
+	return totals;
+}
+
+bool program::instance::start_async(async_file& File, HANDLE const Port, worker_context& Context, run_totals& Totals)
+{
+	auto const& directories = *File.task.directory;
+	build_paths(directories, File.task.name, File.task.dstName, File.paths);
+	if (auto const status = skip_output(directories, File.paths, File.task.attributes))
+	{
+		Totals.add(File.status = *status);
+		return false;
+	}
+	if (mCreateOutputDirectories)
+	{
+		create_output_directory(File.paths);
+	}
+
+	phase_timer const timer(stats(Context), stats_phase::open);
+	unlink_output(File.paths);
+	Context.stats.openCalls += 2;
+	File.src.reset(CreateFileW(File.paths.src.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	if (!File.src)
+	{
+		wdul::throw_last_error("Could not open a target file");
+	}
+	if (mVerbose) mCons.write({ L" \x1b[90mOpened   \x1b[33m\"", File.paths.src, L"\"\x1b[0m\n" });
+
+	File.dst.reset(CreateFileW(File.paths.dst.data(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr));
+	if (!File.dst)
+	{
+		wdul::throw_last_error("Could not create an output file");
+	}
+	if (mVerbose) mCons.write({ L" \x1b[90mCreated  \x1b[33m\"", File.paths.dst, L"\"\x1b[0m\n" });
+
+	File.size = wdul::fgetsize(File.src.get());
+	if (File.size == 0)
+	{
+		mCons.write({ L"\x1b[1;31mSource file ", File.paths.src, L" is empty.\x1b[0m\n" });
+		File.src.reset();
+		File.dst.reset();
+		record_output(directories, File.paths, File.task.attributes);
+		Totals.add(File.status = file_status::created);
+		return false;
+	}
+
+	auto const key = reinterpret_cast<ULONG_PTR>(&File);
+	if (!CreateIoCompletionPort(File.src.get(), Port, key, 0) || !CreateIoCompletionPort(File.dst.get(), Port, key, 0))
+	{
+		wdul::throw_last_error("Could not associate a file with the I/O completion port");
+	}
+	File.port = Port;
+
+	if (!File.buffer)
+	{
+		File.buffer = allocate_buffer(mHeaderRoom + async_block_size);
+	}
+	File.readOffset = 0;
+	File.writeOffset = 0;
+	issue_read(File);
+	return true;
+}
+
+bool program::instance::continue_async(async_file& File, std::uint32_t const Transferred, worker_context& Context, run_totals& Totals)
+{
+	auto const& directories = *File.task.directory;
+	if (!File.writing)
+	{
+		// Data is read in after the room reserved for the header.
+		auto const data = File.buffer.get() + mHeaderRoom;
+		bool const first = File.readOffset == 0;
+		File.readOffset += Transferred;
+		++Context.stats.readCalls;
+		Context.stats.bytesRead += Transferred;
+		bool const atEnd = Transferred == 0 || File.readOffset >= File.size;
+		if (!first && Transferred == 0)
+		{
+			// The target file was truncated while it was being copied.
+			File.size = File.readOffset;
+			if (mPresize) wdul::check_bool(set_file_size(File.dst.get(), File.writeOffset));
+		}
+		else if (first)
+		{
+			phase_timer timer(stats(Context), stats_phase::scan);
+			auto const& syntax = syntax_of(File.task.name);
+			auto const [format, bomSize] = sniff_text({ data, Transferred });
+			auto const header = syntax.header(format, file_name(File.task.name), root_name(directories), Context.header);
+			if (mReplace && is_stamped({ data + bomSize, Transferred - bomSize }, atEnd, syntax, format, header))
+			{
+				File.src.reset();
+				File.dst.reset();
+				timer.next(stats_phase::copy_body);
+				Totals.add(File.status = mirror_stamped(directories, File.paths, File.task.attributes, Context));
+				return false;
+			}
+
+			auto const scan = find_body_offset({ data + bomSize, Transferred - bomSize }, syntax, encoding_of(format), mReplace, atEnd);
+			if (!scan.complete)
+			{
+				// The leading comment lines continue past the first block; let the synchronous path handle this file.
+				File.src.reset();
+				File.dst.reset();
+				timer.stop();
+				// Under /maxmem, the file's pooled buffer, which is as large as a copy buffer, is lent to stamp_file, since
+				// waiting for another here could wait on the files in flight, which only this thread can finish.
+				if (mPool) Context.copyBuffer = std::move(File.buffer);
+				Totals.add(File.status = stamp_file(directories, File.paths, File.task.attributes, Context));
+				if (mPool) Context.copyBuffer.reset();
+				return false;
+			}
+
+			// Place the byte order mark and the header directly before the body, over the skipped comment lines and the
+			// reserved room, and write them with one write.
+			timer.next(stats_phase::write_header);
+			auto const bodyStart = bomSize + scan.offset;
+			auto const output = data + bodyStart - header.size() - bomSize;
+			std::memcpy(output, byte_order_marks[static_cast<std::size_t>(encoding_of(format))].data(), bomSize);
+			std::memcpy(output + bomSize, header.data(), header.size());
+			auto const outputSize = static_cast<std::uint32_t>(bomSize + header.size() + Transferred - bodyStart);
+			if (mPresize && !atEnd)
+			{
+				// Size the output file once, as copy_remainder does, before the overlapped writes fill it in.
+				wdul::check_bool(set_file_size(File.dst.get(), outputSize + (File.size - File.readOffset)));
+			}
+			issue_write(File, output, outputSize);
+			return true;
+		}
+		else
+		{
+			issue_write(File, data, Transferred);
+			return true;
+		}
+	}
+	else
+	{
+		File.writeOffset += Transferred;
+		++Context.stats.writeCalls;
+		Context.stats.bytesWritten += Transferred;
+		if (File.readOffset < File.size)
+		{
+			issue_read(File);
+			return true;
+		}
+	}
+
+	// The whole target file has been copied.
+	File.src.reset();
+	File.dst.reset();
+	record_output(directories, File.paths, File.task.attributes);
+	Totals.add(File.status = file_status::created);
+	return false;
+}
+
+void program::instance::issue_read(async_file& File)
+{
+	File.overlapped = {};
+	File.overlapped.Offset = static_cast<DWORD>(File.readOffset);
+	File.overlapped.OffsetHigh = static_cast<DWORD>(File.readOffset >> 32);
+	File.writing = false;
+	auto const size = static_cast<DWORD>(std::min<std::uint64_t>(File.size - File.readOffset, async_block_size));
+	if (!ReadFile(File.src.get(), File.buffer.get() + mHeaderRoom, size, nullptr, &File.overlapped))
+	{
+		auto const error = GetLastError();
+		if (error == ERROR_HANDLE_EOF)
+		{
+			// The target file shrank below the read offset. No packet is queued for a read which fails at once, so queue
+			// one which completes the read with 0 bytes, as the end of the file does through the port.
+			if (!PostQueuedCompletionStatus(File.port, 0, reinterpret_cast<ULONG_PTR>(&File), &File.overlapped))
+			{
+				wdul::throw_last_error("PostQueuedCompletionStatus failed");
+			}
+		}
+		else if (error != ERROR_IO_PENDING)
+		{
+			wdul::throw_win32(error, "Failed to read from a target file");
+		}
+	}
+	// A completion packet is queued even if the read completed synchronously.
+	File.pending = true;
+}
+
+void program::instance::issue_write(async_file& File, std::uint8_t const* const Data, std::uint32_t const Size)
+{
+	File.overlapped = {};
+	File.overlapped.Offset = static_cast<DWORD>(File.writeOffset);
+	File.overlapped.OffsetHigh = static_cast<DWORD>(File.writeOffset >> 32);
+	File.writing = true;
+	if (!WriteFile(File.dst.get(), Data, Size, nullptr, &File.overlapped))
+	{
+		auto const error = GetLastError();
+		if (error != ERROR_IO_PENDING)
+		{
+			wdul::throw_win32(error, "Failed to write to an output file");
+		}
+	}
+	File.pending = true;
+}
+
+void program::instance::build_paths(directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, target_paths& Paths) const
+{
+	if (Paths.directory != &Directories)
+	{
+		Paths.directory = &Directories;
+		Paths.src = Directories.src;
+		if (!Paths.src.empty())
+		{
+			// If the source directory path is not empty, append a backslash.
+			Paths.src += L'\\';
+		}
+		Paths.srcPrefixLength = Paths.src.size();
+		if (!mInPlace)
+		{
+			// The destination directory is only empty for files named by path in a /files list.
+			Paths.dst = Directories.dst;
+			if (!Paths.dst.empty()) Paths.dst += L'\\';
+			Paths.dstPrefixLength = Paths.dst.size();
+		}
+	}
+	Paths.src.resize(Paths.srcPrefixLength);
+	Paths.src += Fname;
+
+	if (mInPlace)
+	{
+		// The target file is its own output file.
+		Paths.dst = Paths.src;
+	}
+	else
+	{
+		Paths.dst.resize(Paths.dstPrefixLength);
+		Paths.dst += DstFname.empty() ? Fname : DstFname;
+	}
+
+	if (Directories.manifest)
+	{
+		// Manifest paths are relative to the /dir argument the file was found under.
+		Paths.manifest.assign(Paths.src, std::min(Directories.rootLength + (Directories.rootLength != 0), Paths.src.size()));
+	}
+}
+
+std::optional<program::file_status> program::instance::skip_output(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes)
+{
+	if (mJournal && mJournal->contains(Paths.src))
+	{
+		// The interrupted run never saved its manifest, so the output file it wrote is recorded again.
+		if (mVerbose) mCons.write({ L" \x1b[90mResumed  \x1b[33m\"", Paths.src, L"\"\x1b[0m\n" });
+		record_output(Directories, Paths, Attributes);
+		return file_status::resumed;
+	}
+
+	if (Directories.manifest)
+	{
+		// The output file is up to date if neither it nor the source file changed since it was written with the
+		// same notice.
+		auto const previous = Directories.manifest->find(Paths.manifest);
+		WIN32_FILE_ATTRIBUTE_DATA dstAttributes;
+		if (previous &&
+			previous->srcSize == Attributes.size &&
+			previous->srcWriteTime == Attributes.lastWriteTime &&
+			previous->noticeHash == syntax_of(Paths.src).noticeHash &&
+			GetFileAttributesExW(Paths.dst.data(), GetFileExInfoStandard, &dstAttributes) &&
+			previous->dstWriteTime == to_uint64(dstAttributes.ftLastWriteTime))
+		{
+			Directories.manifest->record(std::move(Paths.manifest), *previous);
+			if (mVerbose) mCons.write({ L" \x1b[90mUp to date \x1b[33m\"", Paths.dst, L"\"\x1b[0m\n" });
+			return file_status::up_to_date;
+		}
+	}
+
+	if (mOverwrite != overwrite_policy::always && !mInPlace)
+	{
+		// scan_outputs has found every existing output file, so the file system isn't queried here.
+		auto const existing = mExistingOutputs.find(Paths.dst);
+		if (existing != mExistingOutputs.end() &&
+			(mOverwrite == overwrite_policy::never || Attributes.lastWriteTime <= existing->second))
+		{
+			if (mVerbose) mCons.write({ L" \x1b[90mKept     \x1b[33m\"", Paths.dst, L"\"\x1b[0m\n" });
+			return file_status::declined;
+		}
+	}
+
+	return std::nullopt;
+}
+
+program::file_status program::instance::create_file(directory_argument const& Directories, std::wstring_view const Fname, std::wstring_view const DstFname, file_attributes const& Attributes, worker_context& Context)
+{
+	auto& paths = Context.paths;
+	build_paths(Directories, Fname, DstFname, paths);
+	if (mCheck)
+	{
+		return check_file(paths, Context);
+	}
+	if (auto const status = skip_output(Directories, paths, Attributes))
+	{
+		return *status;
+	}
+	if (mCreateOutputDirectories)
+	{
+		create_output_directory(paths);
+	}
+	return stamp_file(Directories, paths, Attributes, Context);
+}
+
+program::file_status program::instance::check_file(target_paths& Paths, worker_context& Context)
+{
+	auto& counters = Context.stats;
+	phase_timer timer(stats(Context), stats_phase::open);
+	++counters.openCalls;
+	auto srcFile = wdul::fopen(Paths.src.data(), wdul::file_open_mode::open_existing, 0, wdul::generic_access::read, wdul::file_share_mode::read);
+	timer.next(stats_phase::scan);
+
+	// The header, and with /replace the end of the comment it would replace, are looked for in the first block only. A
+	// leading comment which doesn't fit in it is stale, whatever follows it.
+	acquire_copy_buffer(Context);
+	auto const data = Context.copyBuffer.get() + mHeaderRoom;
+	auto const filled = wdul::fread(srcFile.get(), copy_buffer_size, data);
+	auto const atEnd = filled < copy_buffer_size;
+	++counters.readCalls;
+	counters.bytesRead += filled;
+	srcFile.close();
+
+	auto const& syntax = syntax_of(Paths.src);
+	auto const [format, bomSize] = sniff_text({ data, filled });
+	std::span<std::uint8_t const> const text(data + bomSize, filled - bomSize);
+	auto const header = syntax.header(format, file_name(Paths.src), root_name(*Paths.directory), Context.header);
+	if (filled == 0 || is_stamped(text, atEnd, syntax, format, header))
+	{
+		if (mVerbose) mCons.write({ L" \x1b[90mUp to date \x1b[33m\"", Paths.src, L"\"\x1b[0m\n" });
+		return file_status::up_to_date;
+	}
+	auto const scan = find_body_offset(text, syntax, encoding_of(format), true, atEnd);
+	if (!scan.complete || scan.offset != 0)
+	{
+		mCons.write({ L" \x1b[33mStale notice   \"", Paths.src, L"\"\x1b[0m\n" });
+		return file_status::stale;
+	}
+	mCons.write({ L" \x1b[33mMissing notice \"", Paths.src, L"\"\x1b[0m\n" });
+	return file_status::missing;
+}
+
+program::file_status program::instance::stamp_file(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes, worker_context& Context)
+{
+	if (mNaive)
+	{
+		return stamp_naive(Directories, Paths, Attributes, Context);
+	}
+
+	auto& paths = Paths;
+	auto& counters = Context.stats;
+	phase_timer timer(stats(Context), stats_phase::open);
+
+	// The strategy is picked from the size found by enumeration. Files which fit in the copy buffer are read with one
+	// read and written with one write, and need no hint. Larger files are read sequentially, and the largest are
+	// copied with unbuffered I/O unless their body may be cloned instead, or /maxmem leaves no room for its buffers.
+	auto const fitsBuffer = Attributes.size < copy_buffer_size;
+	auto const unbuffered = Attributes.size >= unbuffered_threshold && Directories.cloneClusterSize == 0 && !mPool;
+
+	// The output file is unlinked while the target file is closed, since a hard link can't be deleted while another of
+	// the file's names is open without delete sharing.
+	unlink_output(paths);
+
+	// Open the source file for reading.
+	++counters.openCalls;
+	auto srcFile = wdul::fopen(paths.src.data(), wdul::file_open_mode::open_existing, fitsBuffer ? 0 : FILE_FLAG_SEQUENTIAL_SCAN, wdul::generic_access::read, wdul::file_share_mode::read);
+	if (mVerbose) mCons.write({ L" \x1b[90mOpened   \x1b[33m\"", paths.src, L"\"\x1b[0m\n" });
+	timer.next(stats_phase::scan);
+
+	// Read the first block of the source file after the room reserved for the header. For most files, this is the
+	// whole file.
+	acquire_copy_buffer(Context);
+	auto const& syntax = syntax_of(paths.src);
+	auto const data = Context.copyBuffer.get() + mHeaderRoom;
+	std::size_t filled = 0;
+	bool atEnd = false;
+	auto const fill = [&]
+	{
+		while (filled != copy_buffer_size && !atEnd)
+		{
+			// A read of a file returns less than requested only at its end, so a file which fits in the buffer takes a
+			// single read.
+			auto const requested = static_cast<std::uint32_t>(copy_buffer_size - filled);
+			auto const readSize = wdul::fread(srcFile.get(), requested, data + filled);
+			atEnd = readSize < requested;
+			filled += readSize;
+			++counters.readCalls;
+			counters.bytesRead += readSize;
+		}
+	};
+	fill();
+
+	// The byte order mark stays at the start of the buffer; everything after it is scanned and written in the format
+	// of the target file.
+	auto const [format, bomSize] = sniff_text({ data, filled });
+	auto const encoding = encoding_of(format);
+	auto const header = syntax.header(format, file_name(paths.src), root_name(Directories), Context.header);
+	if (mInPlace && (filled == 0 || is_stamped({ data + bomSize, filled - bomSize }, atEnd, syntax, format, header)))
+	{
+		// Leave files which already start with the header untouched.
+		if (mVerbose) mCons.write({ L" \x1b[90mUp to date \x1b[33m\"", paths.src, L"\"\x1b[0m\n" });
+		srcFile.close();
+		record_output(Directories, paths, Attributes);
+		return file_status::up_to_date;
+	}
+	if (!mInPlace && mReplace && is_stamped({ data + bomSize, filled - bomSize }, atEnd, syntax, format, header))
+	{
+		// The output file would be identical to the target file, so don't copy it through the buffer.
+		srcFile.close();
+		timer.next(stats_phase::copy_body);
+		return mirror_stamped(Directories, paths, Attributes, Context);
+	}
+
+	// In place, the output is written to a temporary file in the same directory, which then replaces the target file,
+	// so that an interrupted run never leaves a partially written target file behind.
+	auto& tempPath = paths.temp;
+	if (mInPlace)
+	{
+		tempPath = paths.src;
+		tempPath += L".copynotice-tmp";
+	}
+	auto const& outputPath = mInPlace ? tempPath : paths.dst;
+	bool keepTemp = false; // set once the temporary file may hold the only copy of the target file.
+
+	try
+	{
+		// Create the destination file for writing.
+		timer.next(stats_phase::open);
+		++counters.openCalls;
+		auto dstFile = wdul::fopen(outputPath.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_NORMAL | (unbuffered ? FILE_FLAG_NO_BUFFERING : 0), wdul::generic_access::write, wdul::file_share_mode::read);
+		auto const copyUnbuffered = unbuffered && allows_unbuffered(dstFile.get());
+		if (unbuffered && !copyUnbuffered)
+		{
+			// The output volume's sectors are larger than unbuffered_alignment, so the file is written through the cache.
+			++counters.openCalls;
+			dstFile = wdul::fopen(outputPath.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_NORMAL, wdul::generic_access::write, wdul::file_share_mode::read);
+		}
+		if (mVerbose && !mInPlace) mCons.write({ L" \x1b[90mCreated  \x1b[33m\"", paths.dst, L"\"\x1b[0m\n" });
+
+		if (filled == 0)
+		{
+			mCons.write({ L"\x1b[1;31mSource file ", paths.src, L" is empty.\x1b[0m\n" });
+			dstFile.close();
+			record_output(Directories, paths, Attributes);
+			return file_status::created;
+		}
+
+		// Find the end of the leading comment lines in memory. Comment lines which don't fit in the buffer are discarded
+		// and the buffer is refilled, so the source file is still only read once.
+		timer.next(stats_phase::scan);
+		body_scan scan;
+		auto const text = data + bomSize;
+		while (!(scan = find_body_offset({ text, filled - bomSize }, syntax, encoding, mReplace, atEnd)).complete)
+		{
+			if (scan.offset == 0)
+			{
+				if (syntax.block())
+				{
+					// A single block comment fills the whole buffer. Discard it up to its closing token, keeping the bytes
+					// which could be the start of a closing token split between reads. In UTF-16, whole code units are
+					// kept, so the text stays aligned.
+					auto const& close = syntax.closes[static_cast<std::size_t>(encoding)];
+					auto const unit = encoding == text_encoding::utf8 ? std::size_t{ 1 } : std::size_t{ 2 };
+					auto searchFrom = syntax.prefixes[static_cast<std::size_t>(encoding)].size();
+					std::uint8_t* closeStart;
+					for (;;)
+					{
+						closeStart = text + searchFrom;
+						while ((closeStart = std::search(closeStart, data + filled, close.begin(), close.end())) != data + filled &&
+							(closeStart - text) % unit != 0)
+						{
+							++closeStart;
+						}
+						if (closeStart != data + filled || atEnd)
+						{
+							break;
+						}
+						auto const keep = std::min(filled - bomSize, close.size() - unit) / unit * unit;
+						std::memmove(text, data + filled - keep, keep);
+						filled = bomSize + keep;
+						searchFrom = 0;
+						fill();
+					}
+					auto const closeEnd = std::min(static_cast<std::size_t>(closeStart - data) + close.size(), filled);
+					std::memmove(text, data + closeEnd, filled - closeEnd);
+					filled -= closeEnd - bomSize;
+				}
+
+				// A single comment line fills the whole buffer. Discard it up to its newline.
+				std::size_t lineEnd;
+				while ((lineEnd = find_line_end({ text, filled - bomSize }, 0, encoding)) == std::u8string_view::npos && !atEnd)
+				{
+					filled = bomSize;
+					fill();
+				}
+				scan.offset = lineEnd != std::u8string_view::npos ? lineEnd : filled - bomSize;
+			}
+			std::memmove(text, text + scan.offset, filled - bomSize - scan.offset);
+			filled -= scan.offset;
+			fill();
+		}
+
+		// Place the byte order mark and the header directly before the body, over the skipped comment lines and the
+		// reserved room, and write them with one write.
+		auto const bodyStart = bomSize + scan.offset;
+		auto const outputSize = bomSize + header.size() + filled - bodyStart;
+		auto const output = data + bodyStart - header.size() - bomSize;
+		std::memcpy(output, byte_order_marks[static_cast<std::size_t>(encoding)].data(), bomSize);
+		std::memcpy(output + bomSize, header.data(), header.size());
+		if (copyUnbuffered)
+		{
+			// The header and the first block are written along with the rest of the file, in aligned blocks.
+			timer.next(stats_phase::copy_body);
+			copy_unbuffered(srcFile.get(), dstFile.get(), { output, outputSize }, Context);
+		}
+		else
+		{
+			timer.next(stats_phase::write_header);
+			write_all(dstFile.get(), outputSize, output);
+			++counters.writeCalls;
+			counters.bytesWritten += outputSize;
+
+			// Write the rest of the source file to the destination file.
+			timer.next(stats_phase::copy_body);
+			if (!atEnd)
+			{
+				copy_remainder(srcFile.get(), dstFile.get(), outputSize, Directories.cloneClusterSize, Context);
+			}
+		}
+
+		dstFile.close();
+
+		if (mInPlace)
+		{
+			// ReplaceFile keeps the target file's attributes, security descriptor and creation time.
+			srcFile.close();
+			if (!ReplaceFileW(paths.src.data(), tempPath.data(), nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr))
+			{
+				auto const lastError = GetLastError();
+				if (lastError == ERROR_UNABLE_TO_MOVE_REPLACEMENT || lastError == ERROR_UNABLE_TO_MOVE_REPLACEMENT_2)
+				{
+					// The target file was already moved aside, so the temporary file holds the only copy of its contents.
+					keepTemp = true;
+					mCons.write({ L"\x1b[1;31mError: Target file ", paths.src, L" could not be replaced. Its rewritten contents are in ", tempPath, L".\x1b[0m\n" });
+					wdul::throw_win32(lastError, "Could not replace a target file");
+				}
+				if (lastError != ERROR_INVALID_FUNCTION && lastError != ERROR_NOT_SUPPORTED)
+				{
+					wdul::throw_win32(lastError, "Could not replace a target file");
+				}
+				// Some file systems, such as FAT and some network shares, don't support ReplaceFile.
+				wdul::check_bool(MoveFileExW(tempPath.data(), paths.src.data(), MOVEFILE_REPLACE_EXISTING));
+			}
+			if (mVerbose) mCons.write({ L" \x1b[90mRewrote  \x1b[33m\"", paths.src, L"\"\x1b[0m\n" });
+		}
+	}
+	catch (...)
+	{
+		if (mInPlace && !keepTemp) DeleteFileW(tempPath.data());
+		throw;
+	}
+
+	record_output(Directories, paths, Attributes);
+	return file_status::created;
+}
+
+program::file_status program::instance::mirror_stamped(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes, worker_context& Context)
+{
+	// The output file may be a hard link from a previous run, which CopyFile would otherwise write through.
+	unlink_output(Paths);
+	if (mLinkStamped)
+	{
+		if (CreateHardLinkW(Paths.dst.data(), Paths.src.data(), nullptr))
+		{
+			if (mVerbose) mCons.write({ L" \x1b[90mLinked   \x1b[33m\"", Paths.dst, L"\"\x1b[0m\n" });
+			record_output(Directories, Paths, Attributes);
+			return file_status::up_to_date;
+		}
+		// Hard links can't cross volumes and aren't supported by every file system; copy the file instead.
+	}
+
+	// CopyFile itself clones the file's extents on volumes which support block cloning.
+	wdul::check_bool(CopyFileW(Paths.src.data(), Paths.dst.data(), FALSE));
+	Context.stats.bytesRead += Attributes.size;
+	Context.stats.bytesWritten += Attributes.size;
+	if (mVerbose) mCons.write({ L" \x1b[90mCopied   \x1b[33m\"", Paths.dst, L"\"\x1b[0m\n" });
+	record_output(Directories, Paths, Attributes);
+	return file_status::up_to_date;
+}
+
+void program::instance::unlink_output(target_paths const& Paths) const
+{
+	if (!mLinkStamped || mInPlace || DeleteFileW(Paths.dst.data()))
+	{
+		return;
+	}
+	auto const lastError = GetLastError();
+	if (lastError != ERROR_FILE_NOT_FOUND)
+	{
+		wdul::throw_win32(lastError, "Could not remove an existing output file");
+	}
+}
+
+bool program::instance::is_stamped(std::span<std::uint8_t const> const Head, bool const AtEnd, comment_syntax const& Syntax, text_format const Format, std::u8string_view const Header) const noexcept
+{
+	if (Head.size() < Header.size() || std::memcmp(Head.data(), Header.data(), Header.size()) != 0)
+	{
+		return false;
+	}
+	if (!mReplace)
+	{
+		return true;
+	}
+	// With /replace, the header must not be followed by more comment lines, which would be replaced as well.
+	auto const scan = find_body_offset(Head.subspan(Header.size()), Syntax, encoding_of(Format), true, AtEnd);
+	return scan.complete && scan.offset == 0;
+}
+
+void program::instance::record_output(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes)
+{
+	if (!Directories.manifest)
+	{
+		return;
+	}
+	WIN32_FILE_ATTRIBUTE_DATA dstAttributes;
+	wdul::check_bool(GetFileAttributesExW(Paths.dst.data(), GetFileExInfoStandard, &dstAttributes));
+	auto const dstWriteTime = to_uint64(dstAttributes.ftLastWriteTime);
+	if (mInPlace)
+	{
+		// The next run will find the rewritten file, not the file that was read.
+		auto const dstSize = (std::uint64_t{ dstAttributes.nFileSizeHigh } << 32) | dstAttributes.nFileSizeLow;
+		Directories.manifest->record(std::move(Paths.manifest), { dstSize, dstWriteTime, dstWriteTime, syntax_of(Paths.src).noticeHash });
+		return;
+	}
+	Directories.manifest->record(std::move(Paths.manifest), { Attributes.size, Attributes.lastWriteTime, dstWriteTime, syntax_of(Paths.src).noticeHash });
+}
+
+void program::instance::copy_unbuffered(HANDLE const Src, HANDLE const Dst, std::span<std::uint8_t const> const Head, worker_context& Context)
+{
+	LARGE_INTEGER position;
+	wdul::check_bool(SetFilePointerEx(Src, LARGE_INTEGER{}, &position, FILE_CURRENT));
+	auto const offset = static_cast<std::uint64_t>(position.QuadPart);
+	auto const size = wdul::fgetsize(Src);
+	auto const outputSize = Head.size() + (offset < size ? size - offset : 0);
+
+	if (mPresize) wdul::check_bool(set_file_size(Dst, outputSize));
+
+	if (!Context.unbufferedBuffer)
+	{
+		Context.unbufferedBuffer.reset(static_cast<std::uint8_t*>(::operator new[](2 * std::size_t{ unbuffered_block_size }, std::align_val_t{ unbuffered_alignment })));
+	}
+	auto const readBuffer = Context.unbufferedBuffer.get();
+	auto const writeBuffer = readBuffer + unbuffered_block_size;
+	std::uint32_t pending = 0; // the number of bytes in writeBuffer.
+
+	auto const append = [&](std::uint8_t const* Data, std::size_t Size)
+	{
+		while (Size != 0)
+		{
+			auto const chunk = static_cast<std::uint32_t>(std::min<std::size_t>(Size, unbuffered_block_size - pending));
+			std::memcpy(writeBuffer + pending, Data, chunk);
+			pending += chunk;
+			Data += chunk;
+			Size -= chunk;
+			if (pending == unbuffered_block_size)
+			{
+				wdul::fwrite(Dst, pending, writeBuffer);
+				++Context.stats.writeCalls;
+				Context.stats.bytesWritten += pending;
+				pending = 0;
+			}
+		}
+	};
+	append(Head.data(), Head.size());
+	std::uint64_t copied = 0; // the number of bytes copied from the source file, which is less than expected if it shrank.
+
+	if (offset < size)
+	{
+		// Unbuffered reads start at a sector boundary, so the bytes before the file pointer in its sector are read again
+		// and skipped. If the source file can't be reopened without buffering, it is read through the cache instead.
+		unique_handle unbufferedSrc;
+		if (allows_unbuffered(Src))
+		{
+			unbufferedSrc = unique_handle(ReOpenFile(Src, GENERIC_READ, FILE_SHARE_READ, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN));
+		}
+		auto source = Src;
+		std::size_t skip = 0;
+		if (unbufferedSrc)
+		{
+			source = unbufferedSrc.get();
+			skip = static_cast<std::size_t>(offset % unbuffered_alignment);
+			position.QuadPart = static_cast<LONGLONG>(offset - skip);
+			wdul::check_bool(SetFilePointerEx(source, position, nullptr, FILE_BEGIN));
+		}
+
+		// A read at the end of a target file which shrank while it was copied may fail with ERROR_HANDLE_EOF rather than
+		// read 0 bytes; both end the copy.
+		auto const read = [&]() -> std::uint32_t
+		{
+			DWORD readSize;
+			if (!ReadFile(source, readBuffer, unbuffered_block_size, &readSize, nullptr))
+			{
+				auto const error = GetLastError();
+				if (error != ERROR_HANDLE_EOF)
+				{
+					wdul::throw_win32(error, "Failed to read from a target file");
+				}
+				readSize = 0;
+			}
+			return readSize;
+		};
+
+		std::uint32_t readSize;
+		while ((readSize = read()) > skip)
+		{
+			++Context.stats.readCalls;
+			Context.stats.bytesRead += readSize - skip;
+			append(readBuffer + skip, readSize - skip);
+			copied += readSize - skip;
+			skip = 0;
+		}
+		++Context.stats.readCalls;
+	}
+
+	// The last write is padded to a whole sector, and the padding cut off again.
+	if (pending != 0)
+	{
+		auto const padded = static_cast<std::uint32_t>((pending + unbuffered_alignment - 1) / unbuffered_alignment * unbuffered_alignment);
+		std::memset(writeBuffer + pending, 0, padded - pending);
+		wdul::fwrite(Dst, padded, writeBuffer);
+		++Context.stats.writeCalls;
+		Context.stats.bytesWritten += pending;
+	}
+	if (pending != 0 || Head.size() + copied != outputSize)
+	{
+		wdul::check_bool(set_file_size(Dst, Head.size() + copied));
+	}
+}
+
+program::file_status program::instance::stamp_naive(directory_argument const& Directories, target_paths& Paths, file_attributes const& Attributes, worker_context& Context)
+{
+	auto& counters = Context.stats;
+	++counters.openCalls;
+	auto srcFile = wdul::fopen(Paths.src.data(), wdul::file_open_mode::open_existing, 0, wdul::generic_access::read, wdul::file_share_mode::read);
+	++counters.openCalls;
+	auto dstFile = wdul::fopen(Paths.dst.data(), wdul::file_open_mode::create_always, FILE_ATTRIBUTE_NORMAL, wdul::generic_access::write, wdul::file_share_mode::read);
+
+	std::uint8_t readBuffer[64]; // temporary storage buffer for reading.
+	auto const write = [&](std::size_t const Size, void const* const Data)
+	{
+		wdul::fwrite(dstFile.get(), static_cast<std::uint32_t>(Size), Data);
+		++counters.writeCalls;
+		counters.bytesWritten += Size;
+	};
+
+	// Store the first line of the source file in firstCodeLine.
+	std::u8string firstCodeLine;
+	++counters.readCalls;
+	if (!wdul::freadline(srcFile.get(), firstCodeLine, sizeof(readBuffer), readBuffer))
+	{
+		mCons.write({ L"\x1b[1;31mSource file ", Paths.src, L" is empty.\x1b[0m\n" });
+		dstFile.close();
+		record_output(Directories, Paths, Attributes);
+		return file_status::created;
+	}
+	auto const& syntax = syntax_of(Paths.src);
+	auto const& prefix = syntax.prefixes[static_cast<std::size_t>(text_encoding::utf8)];
+	if (mReplace && firstCodeLine.starts_with(prefix))
+	{
+		// Read past the comment and any consecutive comments, up to the first non-comment code line.
+		do
+		{
+			++counters.readCalls;
+			if (!wdul::freadline(srcFile.get(), firstCodeLine, sizeof(readBuffer), readBuffer))
+			{
+				firstCodeLine.clear();
+				break;
+			}
+		} while (firstCodeLine.starts_with(prefix));
+	}
+	counters.bytesRead += firstCodeLine.size();
+
+	// Write each line of the header on its own.
+	std::u8string_view header = syntax.header(text_format::utf8_crlf, file_name(Paths.src), root_name(Directories), Context.header);
+	while (!header.empty())
+	{
+		auto const lineEnd = std::min(header.find(u8'\n'), header.size() - 1) + 1;
+		write(lineEnd, header.data());
+		header.remove_prefix(lineEnd);
+	}
+
+	// Write the previously stored first line of the source file to the destination file.
+	static constexpr char8_t newline[] = { u8'\r', u8'\n' };
+	write(firstCodeLine.size(), firstCodeLine.data());
+	write(sizeof(newline), newline);
+
+	// Write the rest of the source file to the destination file.
+	std::uint32_t readSize;
+	while ((readSize = wdul::fread(srcFile.get(), sizeof(readBuffer), readBuffer)) != 0)
+	{
+		++counters.readCalls;
+		counters.bytesRead += readSize;
+		write(readSize, readBuffer);
+	}
+	++counters.readCalls;
+
+	dstFile.close();
+	record_output(Directories, Paths, Attributes);
+	return file_status::created;
+}
+
+bool program::instance::clone_remainder(HANDLE const Src, std::uint64_t const SrcOffset, std::uint64_t const Size, HANDLE const Dst, std::uint64_t const DstOffset,
+	std::uint32_t const ClusterSize, worker_context& Context)
+{
+	// ReFS refuses to clone 4 GiB or more at once.
+	constexpr std::uint64_t max_clone_size = std::uint64_t{ 1 } << 30;
+
+	auto const alignedOffset = (SrcOffset + ClusterSize - 1) / ClusterSize * ClusterSize;
+	if (alignedOffset >= Size)
+	{
+		return false;
+	}
+
+	// The cloned range must lie within the output file, so extend it to its final size first.
+	auto const dstSize = DstOffset + (Size - SrcOffset);
+	if (!set_file_size(Dst, dstSize))
+	{
+		return false;
+	}
+
+	for (auto cloneOffset = alignedOffset; cloneOffset < Size; cloneOffset += max_clone_size)
+	{
+		// The last extent is rounded up to a whole cluster, which is allowed because it ends at the end of the file.
+		auto const cloneSize = std::min(max_clone_size, (Size - cloneOffset + ClusterSize - 1) / ClusterSize * ClusterSize);
+		DUPLICATE_EXTENTS_DATA extents;
+		extents.FileHandle = Src;
+		extents.SourceFileOffset.QuadPart = static_cast<LONGLONG>(cloneOffset);
+		extents.TargetFileOffset.QuadPart = static_cast<LONGLONG>(DstOffset + (cloneOffset - SrcOffset));
+		extents.ByteCount.QuadPart = static_cast<LONGLONG>(cloneSize);
+		DWORD returned;
+		if (!DeviceIoControl(Dst, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), nullptr, 0, &returned, nullptr))
+		{
+			if (cloneOffset != alignedOffset)
+			{
+				wdul::throw_last_error("Could not clone the body of a target file");
+			}
+			// Nothing has been cloned yet, so the caller can still copy the body instead.
+			wdul::check_bool(set_file_size(Dst, DstOffset));
+			return false;
+		}
+		++Context.stats.cloneCalls;
+		Context.stats.bytesCloned += std::min(cloneSize, Size - cloneOffset);
+	}
+
+	// Copy the bytes before the first cluster boundary, which are shorter than a cluster.
+	if (alignedOffset != SrcOffset)
+	{
+		auto const headSize = static_cast<std::uint32_t>(alignedOffset - SrcOffset);
+		auto const readSize = wdul::fread(Src, headSize, Context.copyBuffer.get());
+		write_all(Dst, readSize, Context.copyBuffer.get());
+		++Context.stats.readCalls;
+		++Context.stats.writeCalls;
+		Context.stats.bytesRead += readSize;
+		Context.stats.bytesWritten += readSize;
+	}
+	return true;
+}
+
+void program::instance::copy_remainder(HANDLE const Src, HANDLE const Dst, std::uint64_t const DstOffset, std::uint32_t const CloneClusterSize, worker_context& Context)
+{
+	LARGE_INTEGER position;
+	wdul::check_bool(SetFilePointerEx(Src, LARGE_INTEGER{}, &position, FILE_CURRENT));
+	auto const offset = static_cast<std::uint64_t>(position.QuadPart);
+	auto const size = wdul::fgetsize(Src);
+	if (offset >= size)
+	{
+		return;
+	}
+
+	// Cloning needs the body to land on the same offset within a cluster as in the target file. The header usually
+	// shifts it, but a replaced comment of the same length as the header (a notice whose year changed, say) or a
+	// header of whole clusters doesn't.
+	if (CloneClusterSize != 0 && (DstOffset - offset) % CloneClusterSize == 0 && clone_remainder(Src, offset, size, Dst, DstOffset, CloneClusterSize, Context))
+	{
+		return;
+	}
+
+	// The final size of the output file is known, so it is set once before the body is written, rather than grown by
+	// every write. The file system can then allocate the whole file at once, in as few extents as it can.
+	auto const dstSize = DstOffset + (size - offset);
+	if (mPresize) wdul::check_bool(set_file_size(Dst, dstSize));
+
+	// Mapping a file larger than the address space would fail anyway, so don't try.
+	if (mUseMapping && size <= SIZE_MAX)
+	{
+		mapped_view const view(Src);
+		if (view)
+		{
+			write_all(Dst, size - offset, view.data() + offset);
+			Context.stats.bytesRead += size - offset;
+			Context.stats.bytesWritten += size - offset;
+			Context.stats.writeCalls += (size - offset + max_write_size - 1) / max_write_size;
+			return;
+		}
+	}
+
+	// The source file could not be mapped; fall back to buffered reads. stamp_file has already allocated the buffer.
+	std::uint32_t readSize;
+	auto dstOffset = DstOffset;
+	while ((readSize = wdul::fread(Src, copy_buffer_size, Context.copyBuffer.get())) != 0)
+	{
+		wdul::fwrite(Dst, readSize, Context.copyBuffer.get());
+		dstOffset += readSize;
+		++Context.stats.readCalls;
+		++Context.stats.writeCalls;
+		Context.stats.bytesRead += readSize;
+		Context.stats.bytesWritten += readSize;
+	}
+	++Context.stats.readCalls;
+
+	// The target file changed size while it was copied.
+	if (mPresize && dstOffset < dstSize) wdul::check_bool(set_file_size(Dst, dstOffset));
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace program
+{
+	class instance;
+}
+
+// The stamping engine of copynotice, for programs which stamp many trees without starting a process for each.
+namespace copynotice
+{
+	// What to do with a target file whose output file already exists.
+	enum class overwrite_policy : std::uint8_t
+	{
+		ask,    // ask once, before any file is processed, whether to overwrite every existing output file.
+		always,
+		never,
+		newer,  // overwrite the output file if the target file was written after it.
+	};
+
+	// The outcome of processing one target file.
+	enum class file_status : std::uint8_t
+	{
+		created,    // the output file was written.
+		declined,   // the output file already existed and the overwrite policy kept it.
+		up_to_date, // the output file was left untouched because it is already up to date.
+		missing,    // /check: the target file doesn't start with a comment.
+		stale,      // /check: the target file starts with a comment which isn't the header.
+		resumed,    // /resume: the interrupted run already finished the target file.
+	};
+
+	// Counts the outcomes of processing target files.
+	struct run_totals
+	{
+		std::uint32_t created = 0;
+		std::uint32_t upToDate = 0;
+		std::uint32_t declined = 0;
+		std::uint32_t missing = 0;
+		std::uint32_t stale = 0;
+		std::uint32_t resumed = 0;
+
+		void add(file_status const Status) noexcept
+		{
+			if (Status == file_status::created) ++created;
+			else if (Status == file_status::up_to_date) ++upToDate;
+			else if (Status == file_status::declined) ++declined;
+			else if (Status == file_status::missing) ++missing;
+			else if (Status == file_status::stale) ++stale;
+			else if (Status == file_status::resumed) ++resumed;
+		}
+
+		run_totals& operator+=(run_totals const& Other) noexcept
+		{
+			created += Other.created;
+			upToDate += Other.upToDate;
+			declined += Other.declined;
+			missing += Other.missing;
+			stale += Other.stale;
+			resumed += Other.resumed;
+			return *this;
+		}
+	};
+
+	// A target file extension, and the comment syntax of its notice.
+	struct extension_syntax
+	{
+		std::wstring name; // without the dot, as with /ext.
+		std::wstring syntax; // as with /syntax, or empty to use batch_config::syntax.
+	};
+
+	// The options of a batch, which correspond to the command line arguments of the same names.
+	struct batch_config
+	{
+		std::wstring notice; // "{file}", "{root}" and "{year}" are replaced, as with /note.
+		std::wstring syntax = L"// "; // the default comment syntax.
+		std::vector<extension_syntax> extensions;
+		overwrite_policy overwrite = overwrite_policy::ask; // ask calls batch_callbacks::confirmOverwrite.
+		bool recurse = false;
+		bool replace = false;
+		bool inPlace = false;
+		bool check = false; // implies inPlace, which must not be set as well.
+		bool incremental = false;
+		bool link = false;
+		bool verbose = false;
+		bool stats = false; // batch_result::counters is only filled in if set.
+		std::uint32_t jobs = 0; // the number of worker threads, or 0 to process files on the calling thread.
+		std::uint32_t async = 0; // the number of files in flight with overlapped I/O, or 0 to use synchronous I/O.
+		std::uint64_t maxMemory = 0; // the /maxmem budget in bytes, or 0 for no budget.
+	};
+
+	// A directory to search, as with /dir. Both paths are checked as the subarguments of /dir are.
+	struct batch_root
+	{
+		std::wstring src; // empty for the current directory.
+		std::wstring dst; // empty with inPlace or check.
+	};
+
+	// The outcome of one target file, passed to batch_callbacks::file.
+	struct file_result
+	{
+		std::wstring_view path; // the path of the target file; only valid during the call.
+		file_status status;
+		std::uint64_t size;
+		std::uint32_t microseconds;
+	};
+
+	// The counters of /stats, summed over a batch run.
+	struct run_counters
+	{
+		std::uint64_t files = 0;
+		std::uint64_t bytesRead = 0;
+		std::uint64_t bytesWritten = 0;
+		std::uint64_t bytesCloned = 0;
+		std::uint64_t findCalls = 0;
+		std::uint64_t openCalls = 0;
+		std::uint64_t readCalls = 0;
+		std::uint64_t writeCalls = 0;
+		std::uint64_t cloneCalls = 0;
+	};
+
+	struct batch_result
+	{
+		run_totals totals;
+		run_counters counters;
+		double seconds = 0.0;
+
+		// Returns true if a check found target files which need stamping.
+		[[nodiscard]] bool needs_stamping() const noexcept
+		{
+			return totals.missing + totals.stale != 0;
+		}
+	};
+
+	// Receives what the console would show during a batch run. Every callback may be left empty.
+	struct batch_callbacks
+	{
+		// Called with each line of output, without virtual terminal sequences. Calls never overlap.
+		std::function<void(std::wstring_view Line)> message;
+
+		// Called once each target file is finished. With jobs, it is called from several worker threads at once.
+		std::function<void(file_result const& Result)> file;
+
+		// Called with overwrite_policy::ask before any file is processed, if output files which target files map to
+		// already exist, with their number. Returns true to overwrite them. Without this callback, they are kept.
+		std::function<bool(std::size_t ExistingOutputs)> confirmOverwrite;
+	};
+
+	// Stamps any number of sets of roots with one configuration. The headers of every comment syntax are rendered once,
+	// when the batch is created, rather than for every run.
+	class batch
+	{
+	public:
+		// No copy/move.
+		batch(batch const&) = delete;
+		batch(batch&&) = delete;
+		batch& operator=(batch const&) = delete;
+		batch& operator=(batch&&) = delete;
+
+		// Checks the configuration and renders the headers. Throws std::invalid_argument if the configuration is invalid.
+		explicit batch(batch_config const& Config);
+
+		~batch();
+
+		// Processes the target files under Roots, creating missing output directories. Throws std::invalid_argument if a
+		// root is invalid. Runs may not overlap.
+		batch_result run(std::span<batch_root const> Roots, batch_callbacks const& Callbacks = {});
+
+	private:
+		overwrite_policy mOverwrite;
+		std::unique_ptr<program::instance> mInstance;
+	};
+
+	// Runs copynotice with command line arguments, writing to the console. Returns the exit code.
+	int run_command_line(int ArgCount, wchar_t** Args);
+}